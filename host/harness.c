@@ -0,0 +1,565 @@
+/* Host benchmark and fuzz driver for the kernel's pure logic units.
+ *
+ *   argaldos-host bench [--disk IMAGE NAME]   allocator throughput, FAT cluster walks and ELF parsing
+ *   argaldos-host fuzz [ROUNDS] [SEED]        random inputs against pmm/slab, fat32, elf, string, printf, binop
+ *                                             and the SSE2/AVX2 kernels
+ *
+ * pmm.c, slab.c, pool.c, arena.c, fat32.c, elf.c, vma.c, string.c, printf.c, binop.c, simd_sse2.c and simd_avx2.c
+ * are the kernel's own sources; shim.c stands in for the hardware below them. The FAT and ELF inputs are synthetic images
+ * built here, or a real image such as bin/disk.vfat with --disk. Build with "make host-bench" or
+ * "make host-fuzz" (the latter with ASan and UBSan).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <kernel/kernel.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/vmalloc.h>
+#include <kernel/elf.h>
+#include <kernel/vma.h>
+#include <kernel/address_space.h>
+#include <kernel/simd.h>
+#include <fs/fat/fat32.h>
+#include <stdlib/binop.h>
+#include "host.h"
+
+#define HOST_MEMORY_SIZE (256ULL << 20)
+#define FAT_RESERVED_SECTORS 32
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+static void put64(uint8_t *p, uint64_t v) { put32(p, v); put32(p + 4, v >> 32); }
+
+// xorshift, so a failing fuzz seed replays the same way everywhere
+static uint64_t rngState = 0x9E3779B97F4A7C15ULL;
+static uint64_t rng(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// Synthetic images
+//
+
+// FAT32 volume with one sector per cluster and a single file, BIG.BIN, whose clusters follow each other.
+static uint8_t *build_fat_image(uint32_t clusters, uint64_t *size) {
+    uint32_t fatSectors = ((clusters + 3) * 4 + 511) / 512;
+    uint32_t dataStart = FAT_RESERVED_SECTORS + 2 * fatSectors;
+    uint32_t totalSectors = dataStart + 1 + clusters; // cluster 2 is the root directory
+    uint8_t *image = calloc(totalSectors, 512);
+    *size = (uint64_t)totalSectors * 512;
+
+    image[0] = 0xEB; image[1] = 0x58; image[2] = 0x90;
+    memcpy(image + 3, "ARGALDOS", 8);
+    put16(image + 0x0B, 512);
+    image[0x0D] = 1;
+    put16(image + 0x0E, FAT_RESERVED_SECTORS);
+    image[0x10] = 2;
+    image[0x15] = 0xF8;
+    put32(image + 0x20, totalSectors);
+    put32(image + 0x24, fatSectors);
+    put32(image + 0x2C, 2);
+    image[0x42] = 0x29;
+    memcpy(image + 0x47, "HOSTHARNESS", 11);
+    memcpy(image + 0x52, "FAT32   ", 8);
+    image[0x1FE] = 0x55; image[0x1FF] = 0xAA;
+
+    uint8_t *fat = image + FAT_RESERVED_SECTORS * 512;
+    put32(fat + 0, 0x0FFFFFF8);
+    put32(fat + 4, 0x0FFFFFFF);
+    put32(fat + 8, 0x0FFFFFFF);
+    for (uint32_t i = 0; i < clusters; i++)
+        put32(fat + (3 + i) * 4, i + 1 == clusters ? 0x0FFFFFFF : 4 + i);
+    memcpy(fat + fatSectors * 512, fat, fatSectors * 512);
+
+    uint8_t *root = image + (uint64_t)dataStart * 512;
+    memcpy(root, "BIG     BIN", 11);
+    root[0x0B] = 0x20;
+    put16(root + 0x1A, 3);
+    put32(root + 0x1C, clusters * 512);
+
+    for (uint32_t i = 0; i < clusters; i++)
+        memset(image + (uint64_t)(dataStart + 1 + i) * 512, (uint8_t)i, 512);
+    return image;
+}
+
+// Executable with a NULL section and then sections alternating between PROGBITS (loaded) and SYMTAB (skipped).
+static uint8_t *build_elf_image(int sections, uint64_t sectionSize, uint64_t *size) {
+    int count = 1 + sections;
+    uint64_t dataOffset = 0x40;
+    uint64_t headersOffset = dataOffset + (uint64_t)sections * sectionSize;
+    *size = headersOffset + (uint64_t)count * 64;
+    uint8_t *elf = calloc(1, *size);
+
+    memcpy(elf, "\x7F" "ELF", 4);
+    elf[4] = 2; elf[5] = 1; elf[6] = 1;
+    put16(elf + 0x10, 2);
+    put16(elf + 0x12, 0x3E);
+    put32(elf + 0x14, 1);
+    put64(elf + 0x18, 0x400000);
+    put64(elf + 0x28, headersOffset);
+    put16(elf + 0x34, 0x40);
+    put16(elf + 0x3A, 64);
+    put16(elf + 0x3C, count);
+
+    for (int i = 0; i < sections; i++) {
+        uint8_t *sh = elf + headersOffset + (uint64_t)(i + 1) * 64;
+        put32(sh + 0x04, (i & 1) ? 2 : 1);
+        put64(sh + 0x08, 2); // SHF_ALLOC, or the loader leaves the section out
+        put64(sh + 0x10, 0x400000 + (uint64_t)i * ((sectionSize + 0xFFF) & ~0xFFFULL));
+        put64(sh + 0x18, dataOffset + (uint64_t)i * sectionSize);
+        put64(sh + 0x20, sectionSize);
+        memset(elf + dataOffset + (uint64_t)i * sectionSize, i, sectionSize);
+    }
+    return elf;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+//
+
+static void report(const char *name, uint64_t ops, uint64_t bytes, uint64_t ns) {
+    printf("%-28s %10.0f ops/s %8.1f ns/op", name, ops * 1e9 / ns, (double)ns / ops);
+    if (bytes)
+        printf(" %9.1f MB/s", bytes * 1e3 / ns);
+    printf("\n");
+}
+
+static void bench_pmm(void) {
+    enum { ROUNDS = 200, BATCH = 4096 };
+    static uint64_t frames[BATCH];
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++)
+            frames[i] = alloc_pages(0);
+        for (int i = 0; i < BATCH; i++)
+            free_pages(frames[i], 0);
+    }
+    report("alloc_pages(0)+free_pages", (uint64_t)ROUNDS * BATCH, 0, now_ns() - start);
+
+    start = now_ns();
+    uint64_t ops = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < 256; i++) {
+            uint8_t order = rng() % 6;
+            frames[i] = alloc_pages(order) | order; // frames are page aligned, the order fits underneath
+        }
+        for (int i = 0; i < 256; i++)
+            if (frames[i] & ~0xFFFULL)
+                free_pages(frames[i] & ~0xFFFULL, frames[i] & 0xFFF);
+        ops += 256;
+    }
+    report("alloc_pages(0..5) mixed", ops, 0, now_ns() - start);
+
+    static void *objects[BATCH];
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++)
+            objects[i] = kmalloc(16 << (i % 8));
+        for (int i = 0; i < BATCH; i++)
+            kfree(objects[i]);
+    }
+    report("kmalloc+kfree 16..2048", (uint64_t)ROUNDS * BATCH, 0, now_ns() - start);
+}
+
+static void bench_fat(const char *diskPath, const char *name) {
+    uint64_t size = 0;
+    uint8_t *image = NULL;
+    if (diskPath) {
+        FILE *file = fopen(diskPath, "rb");
+        if (!file) {
+            perror(diskPath);
+            exit(1);
+        }
+        fseek(file, 0, SEEK_END);
+        size = ftell(file);
+        rewind(file);
+        image = malloc(size);
+        if (fread(image, 1, size, file) != size) {
+            perror(diskPath);
+            exit(1);
+        }
+        fclose(file);
+    } else {
+        image = build_fat_image(16384, &size);
+        name = "BIG";
+    }
+    host_disk_set(image, size);
+
+    uint32_t fileSize = 0;
+    uint8_t *data = load_file((char*)name, &fileSize);
+    if (!data) {
+        printf("fat: %s not found\n", name);
+        exit(1);
+    }
+    if (!diskPath) {
+        for (uint32_t i = 0; i < fileSize; i += 512) {
+            if (data[i] != (uint8_t)(i / 512)) {
+                printf("fat: BIG.BIN differs at cluster %u\n", i / 512);
+                exit(1);
+            }
+        }
+    }
+    vfree(data);
+
+    enum { ROUNDS = 20 };
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++)
+        vfree(load_file((char*)name, &fileSize));
+    uint64_t ns = now_ns() - start;
+    uint64_t clusters = (fileSize + 511) / 512;
+    report("fat32 load_file", ROUNDS, (uint64_t)ROUNDS * fileSize, ns);
+    report("fat32 cluster walk", ROUNDS * clusters, 0, ns);
+    host_disk_set(NULL, 0);
+    free(image);
+}
+
+// Loads elf into a space of its own and touches up to maxPages pages of every VMA, running the fill a first
+// access would. Returns the space, current, for the caller to destroy, or NULL if the loader turned elf down.
+static struct addressSpace *fault_in_elf(const uint8_t *elf, uint64_t size, uint64_t maxPages) {
+    struct addressSpace *space = address_space_create();
+    uint64_t entry = 0;
+    if (load_elf(space, elf, size, &entry) != 0) {
+        address_space_destroy(space);
+        return NULL;
+    }
+    address_space_switch(space);
+    for (struct vma *vma = space->vmas; vma; vma = vma->next) {
+        for (uint64_t i = 0; i < maxPages && vma->start + i * 4096 < vma->end; i++)
+            vma_handle_fault(vma->start + i * 4096, 0);
+    }
+    return space;
+}
+
+static void bench_elf(void) {
+    uint64_t size = 0;
+    uint8_t *elf = build_elf_image(256, 16384, &size);
+    enum { ROUNDS = 50 };
+    uint64_t filled = 0;
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        address_space_destroy(fault_in_elf(elf, size, UINT64_MAX));
+        filled += host_pages_mapped();
+        host_release_mapped_pages();
+    }
+    report("load_elf+faults 256 sections", ROUNDS, filled * 4096, now_ns() - start);
+    free(elf);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// Fuzzing
+//
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { failures++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+static void random_string(char *s, int length, int alphabet) {
+    for (int i = 0; i < length; i++)
+        s[i] = 'a' + rng() % alphabet;
+    s[length] = 0;
+}
+
+static void fuzz_string(int rounds) {
+    char a[160], b[160];
+    for (int r = 0; r < rounds; r++) {
+        char *pa = a + rng() % 16, *pb = b + rng() % 16;
+        int length = rng() % 100;
+        random_string(pa, length, 3);
+        memcpy(pb, pa, length + 1);
+        if (rng() & 1)
+            pb[rng() % (length + 1)] = rng() & 1 ? 0 : 'a' + rng() % 4;
+        size_t n = rng() % 120;
+        CHECK(argaldos_strlen(pa) == (int)strlen(pa), "strlen(\"%s\")", pa);
+        CHECK(argaldos_strcmp(pa, pb) == (strcmp(pa, pb) == 0), "strcmp(\"%s\", \"%s\")", pa, pb);
+        CHECK(sign(strcmp_order(pa, pb)) == sign(strcmp(pa, pb)), "strcmp_order(\"%s\", \"%s\")", pa, pb);
+        CHECK(sign(argaldos_strncmp(pa, pb, n)) == sign(strncmp(pa, pb, n)), "strncmp(\"%s\", \"%s\", %zu)", pa, pb, n);
+    }
+}
+
+static void fuzz_printf(int rounds) {
+    static const char *intFormats[] = { "%d", "%i", "%u", "%x", "%X", "%o", "%5d", "%-5d|", "%05d", "%+d", "% d",
+                                        "%.3d", "%#x", "%#o", "%ld", "%lx", "%zu", "%c" };
+    static const char *stringFormats[] = { "%s", "%.2s", "%10s", "%-10s|" };
+    char ours[128], theirs[128], text[40];
+    for (int r = 0; r < rounds; r++) {
+        const char *format = intFormats[rng() % (sizeof(intFormats) / sizeof(*intFormats))];
+        long value = (long)rng() >> (rng() % 64);
+        if (strchr(format, 'l') || strchr(format, 'z')) {
+            snprintf_(ours, sizeof(ours), format, value);
+            snprintf(theirs, sizeof(theirs), format, value);
+        } else if (strchr(format, 'c')) {
+            snprintf_(ours, sizeof(ours), format, 'A' + (int)(value & 31));
+            snprintf(theirs, sizeof(theirs), format, 'A' + (int)(value & 31));
+        } else {
+            snprintf_(ours, sizeof(ours), format, (int)value);
+            snprintf(theirs, sizeof(theirs), format, (int)value);
+        }
+        CHECK(!strcmp(ours, theirs), "\"%s\": \"%s\" != \"%s\"", format, ours, theirs);
+
+        format = stringFormats[rng() % (sizeof(stringFormats) / sizeof(*stringFormats))];
+        random_string(text, rng() % 30, 26);
+        snprintf_(ours, sizeof(ours), format, text);
+        snprintf(theirs, sizeof(theirs), format, text);
+        CHECK(!strcmp(ours, theirs), "\"%s\": \"%s\" != \"%s\"", format, ours, theirs);
+
+        // truncation must still terminate the buffer
+        size_t count = 1 + rng() % 8;
+        int length = snprintf_(ours, count, "%s", text);
+        CHECK(length == (int)strlen(text) && strlen(ours) == (length < (int)count ? (size_t)length : count - 1),
+              "snprintf truncation to %zu", count);
+    }
+}
+
+static void fuzz_binop(int rounds) {
+    for (int r = 0; r < rounds; r++) {
+        uint8_t b[8];
+        for (int i = 0; i < 8; i++)
+            b[i] = rng();
+        uint32_t w32 = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+        uint64_t w64 = (uint64_t)w32 << 32 | (uint32_t)b[4] << 24 | (uint32_t)b[5] << 16 | (uint32_t)b[6] << 8 | b[7];
+        CHECK(combine32bit(b[0], b[1], b[2], b[3]) == w32, "combine32bit");
+        CHECK(combine64bit(b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7]) == w64, "combine64bit");
+    }
+}
+
+// Random alloc/free sequences, with a shadow map of which frames are handed out to catch overlaps.
+static void fuzz_pmm(int rounds) {
+    enum { LIVE = 512 };
+    uint64_t frameCount = HOST_MEMORY_SIZE / 4096;
+    uint8_t *owned = calloc(frameCount, 1);
+    struct { uint64_t addr; uint8_t order; } blocks[LIVE] = {{0}};
+    void *objects[LIVE] = {0};
+    size_t objectSizes[LIVE] = {0};
+
+    for (int r = 0; r < rounds; r++) {
+        int slot = rng() % LIVE;
+        if (blocks[slot].addr) {
+            uint64_t first = (blocks[slot].addr - HOST_PHYS_BASE) / 4096;
+            uint8_t *memory = (uint8_t*)(blocks[slot].addr + kernel.hhdm);
+            CHECK(memory[0] == (uint8_t)slot, "block %d was overwritten", slot);
+            for (uint64_t f = 0; f < (1ULL << blocks[slot].order); f++)
+                owned[first + f] = 0;
+            free_pages(blocks[slot].addr, blocks[slot].order);
+            // a second free of a frame sitting in a magazine must be refused, or it's handed out twice below
+            if (blocks[slot].order == 0 && rng() % 4 == 0)
+                free_pages(blocks[slot].addr, blocks[slot].order);
+            blocks[slot].addr = 0;
+        } else {
+            uint8_t order = rng() % 8;
+            uint64_t addr = alloc_pages(order);
+            if (addr) {
+                uint64_t first = (addr - HOST_PHYS_BASE) / 4096;
+                CHECK((addr & ((4096ULL << order) - 1)) == 0, "order %d block at %#lx is misaligned", order, addr);
+                for (uint64_t f = 0; f < (1ULL << order); f++) {
+                    CHECK(!owned[first + f], "frame %#lx handed out twice", addr + f * 4096);
+                    owned[first + f] = 1;
+                }
+                ((uint8_t*)(addr + kernel.hhdm))[0] = slot;
+                blocks[slot].addr = addr;
+                blocks[slot].order = order;
+            }
+        }
+
+        slot = rng() % LIVE;
+        if (objects[slot]) {
+            uint8_t *bytes = objects[slot];
+            CHECK(bytes[0] == (uint8_t)slot && bytes[objectSizes[slot] - 1] == (uint8_t)slot,
+                  "kmalloc object %d was overwritten", slot);
+            kfree(objects[slot]);
+            objects[slot] = NULL;
+        } else {
+            objectSizes[slot] = 1 + rng() % 12000;
+            objects[slot] = kmalloc(objectSizes[slot]);
+            if (objects[slot])
+                memset(objects[slot], slot, objectSizes[slot]);
+        }
+    }
+    for (int i = 0; i < LIVE; i++) {
+        if (blocks[i].addr)
+            free_pages(blocks[i].addr, blocks[i].order);
+        if (objects[i])
+            kfree(objects[i]);
+    }
+    free(owned);
+}
+
+// The scalar definition simd_checksum32() falls back to
+static uint32_t checksum32_reference(const uint8_t *p, size_t n) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += (uint32_t)p[i] << (8 * (i & 3));
+    return total;
+}
+
+// Every vector kernel against libc or the scalar reference, at odd lengths and alignments so the unrolled
+// loops, the single vector loops and the byte tails all run.
+static void fuzz_simd_kernels(int rounds, const char *set, void (*copy)(void*, const void*, size_t),
+                              void (*fill)(void*, uint8_t, size_t), void (*fill_nt)(void*, uint8_t, size_t),
+                              int (*compare)(const void*, const void*, size_t),
+                              uint32_t (*checksum)(const void*, size_t)) {
+    static uint8_t a[1200], b[1200], expected[1200];
+    for (int r = 0; r < rounds; r++) {
+        size_t n = rng() % 1024;
+        uint8_t *pa = a + rng() % 64, *pb = b + rng() % 64;
+        for (size_t i = 0; i < n; i++)
+            pa[i] = rng();
+
+        memset(b, 0xEE, sizeof(b));
+        copy(pb, pa, n);
+        CHECK(!memcmp(pa, pb, n) && pb[n] == 0xEE, "memcpy_%s of %zu bytes", set, n);
+
+        uint8_t c = rng();
+        memcpy(expected, b, sizeof(b));
+        memset(expected + (pb - b), c, n);
+        (rng() & 1 ? fill : fill_nt)(pb, c, n);
+        asm volatile ("sfence" : : : "memory");
+        CHECK(!memcmp(expected, b, sizeof(b)), "memset(_nt)_%s of %zu bytes", set, n);
+
+        memcpy(pb, pa, n);
+        if (n && rng() % 4)
+            pb[rng() % n] ^= 1 << (rng() % 8);
+        CHECK(sign(compare(pa, pb, n)) == sign(memcmp(pa, pb, n)), "memcmp_%s of %zu bytes", set, n);
+        CHECK(checksum(pa, n) == checksum32_reference(pa, n), "checksum32_%s of %zu bytes", set, n);
+    }
+}
+
+static void fuzz_simd(int rounds) {
+    fuzz_simd_kernels(rounds, "sse2", memcpy_sse2, memset_sse2, memset_nt_sse2, memcmp_sse2, checksum32_sse2);
+    if (__builtin_cpu_supports("avx2"))
+        fuzz_simd_kernels(rounds, "avx2", memcpy_avx2, memset_avx2, memset_nt_avx2, memcmp_avx2, checksum32_avx2);
+    else
+        printf("no AVX2 on this CPU, skipping the AVX2 kernels\n");
+}
+
+// The loaded program has to keep its contents once the file it came from is gone, and corrupted headers and
+// section tables must be rejected, not read past the end of the buffer.
+static void fuzz_elf(int rounds) {
+    uint64_t size = 0;
+    uint8_t *pristine = build_elf_image(6, 3000, &size);
+
+    uint8_t *copy = malloc(size);
+    memcpy(copy, pristine, size);
+    struct addressSpace *space = address_space_create();
+    uint64_t entry = 0;
+    CHECK(load_elf(space, copy, size, &entry) == 0, "load_elf of a valid image");
+    free(copy);
+    address_space_switch(space);
+    for (int i = 0; i < 6; i += 2) {
+        // PROGBITS section i is 3000 bytes of i, one page each from 0x400000
+        uint64_t virt = 0x400000 + (uint64_t)i * 4096;
+        CHECK(vma_handle_fault(virt, 0), "fault at %#lx", virt);
+        uint64_t frame = address_space_translate(space, virt);
+        const uint8_t *page = frame ? (const uint8_t*)(frame + kernel.hhdm) : NULL;
+        bool intact = page != NULL;
+        for (int b = 0; intact && b < 4096; b++)
+            intact = page[b] == (b < 3000 ? i : 0);
+        CHECK(intact, "section %d after the file was freed", i);
+    }
+    address_space_destroy(space);
+    host_release_mapped_pages();
+
+    for (int r = 0; r < rounds; r++) {
+        uint64_t length = rng() % 4 ? size : rng() % (size + 1);
+        uint8_t *elf = malloc(length ? length : 1);
+        memcpy(elf, pristine, length);
+        int flips = 1 + rng() % 8;
+        for (int i = 0; i < flips && length; i++) {
+            // mostly the header and section table, where the offsets are
+            uint64_t at = rng() & 1 ? rng() % (length < 0x40 ? length : 0x40) : rng() % length;
+            elf[at] ^= 1 << (rng() % 8);
+        }
+        read_elf(elf, length, false);
+        // the fills run on pages of whatever got through, after the file is gone
+        space = fault_in_elf(elf, length, 16);
+        free(elf);
+        if (space) {
+            for (struct vma *vma = space->vmas; vma; vma = vma->next)
+                vma_handle_fault(vma->end - 4096, 0);
+            address_space_destroy(space);
+        }
+        host_release_mapped_pages();
+    }
+    free(pristine);
+}
+
+// Corrupted FAT tables and directory sectors; the file size is left alone so walks stay bounded.
+static void fuzz_fat(int rounds) {
+    uint64_t size = 0;
+    uint8_t *pristine = build_fat_image(64, &size);
+    uint8_t *image = malloc(size);
+    uint32_t fatSectors = ((64 + 3) * 4 + 511) / 512;
+    uint64_t root = (uint64_t)(FAT_RESERVED_SECTORS + 2 * fatSectors) * 512;
+    for (int r = 0; r < rounds; r++) {
+        memcpy(image, pristine, size);
+        if (rng() & 1) {
+            for (int i = 0; i < 8; i++)
+                image[FAT_RESERVED_SECTORS * 512 + rng() % (fatSectors * 512)] = rng();
+        } else {
+            for (int i = 0x20; i < 512; i++)
+                image[root + i] = rng();
+            for (int i = 0; i < 0x1C; i++)
+                if (rng() % 4 == 0)
+                    image[root + i] = rng();
+        }
+        host_disk_set(image, size);
+        uint32_t fileSize = 0;
+        uint8_t *data = load_file("BIG", &fileSize);
+        if (data)
+            vfree(data);
+    }
+    host_disk_set(NULL, 0);
+    free(image);
+    free(pristine);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "bench";
+    if (getenv("ARGALDOS_HOST_VERBOSE"))
+        host_verbose = true;
+    host_memory_init(HOST_MEMORY_SIZE);
+
+    if (!strcmp(mode, "bench")) {
+        const char *disk = NULL, *name = NULL;
+        if (argc > 4 && !strcmp(argv[2], "--disk")) {
+            disk = argv[3];
+            name = argv[4];
+        }
+        bench_pmm();
+        bench_fat(disk, name);
+        bench_elf();
+        return 0;
+    }
+    if (!strcmp(mode, "fuzz")) {
+        int rounds = argc > 2 ? atoi(argv[2]) : 20000;
+        if (argc > 3)
+            rngState = strtoull(argv[3], NULL, 0) | 1;
+        printf("fuzzing %d rounds, seed %#lx\n", rounds, rngState);
+        fuzz_string(rounds);
+        fuzz_printf(rounds);
+        fuzz_binop(rounds);
+        fuzz_simd(rounds);
+        fuzz_pmm(rounds);
+        fuzz_elf(rounds);
+        fuzz_fat(rounds);
+        printf("%d failures\n", failures);
+        return failures != 0;
+    }
+    fprintf(stderr, "usage: %s bench [--disk IMAGE NAME] | fuzz [ROUNDS] [SEED]\n", argv[0]);
+    return 2;
+}
@@ -0,0 +1,27 @@
+/* Shared between the host shims and the harness driver.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef HOST_H
+#define HOST_H
+
+// fake physical memory, reachable through kernel.hhdm like on the real machine
+#define HOST_PHYS_BASE 0x100000000ULL // 4 GiB, so the frames land in ZONE_NORMAL
+
+void host_memory_init(uint64_t size);
+void host_disk_set(uint8_t *image, uint64_t size);
+uint64_t host_pages_mapped(void);
+void host_release_mapped_pages(void);
+extern bool host_verbose;
+
+// kernel string functions, under the names host/rename.h gives them
+int argaldos_strlen(const char s[]);
+bool argaldos_strcmp(const char* str1, const char* str2);
+int argaldos_strncmp(const char* s1, const char* s2, size_t n);
+int strcmp_order(const char* str1, const char* str2);
+int snprintf_(char* buffer, size_t count, const char* format, ...);
+
+#endif
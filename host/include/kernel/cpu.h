@@ -0,0 +1,24 @@
+/* Host stand-in for src/kernel/cpu.h: there's one thread and no interrupt flag to touch from user space.
+ * Found first on the include path, so the kernel sources pick it up in place of the real one.
+ */
+
+#include <stdint.h>
+
+#ifndef CPU_H
+#define CPU_H
+
+#define MAX_CPUS 16
+
+static inline uint32_t this_cpu(void) {
+    return 0;
+}
+
+static inline uint64_t irq_save(void) {
+    return 0;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    (void)flags;
+}
+
+#endif
@@ -0,0 +1,10 @@
+/* Force-included into the kernel units built for the host. stdlib/string.c defines functions with libc
+ * names but different signatures (strcmp returns a bool there), so they get their own names here.
+ */
+
+#define strlen   argaldos_strlen
+#define strcmp   argaldos_strcmp
+#define strncmp  argaldos_strncmp
+#define strcpy   argaldos_strcpy
+#define strcat   argaldos_strcat
+#define isspace  argaldos_isspace
@@ -0,0 +1,195 @@
+/* Host shims for the kernel units the harness links: fake physical memory behind a fake HHDM, a disk that
+ * is a memory buffer, console output that goes nowhere unless asked, and stand-ins for the hardware paths
+ * (paging, SIMD, non-temporal stores) the pure logic under test calls into.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <limine.h>
+#include <kernel/kernel.h>
+#include <kernel/pmm.h>
+#include <kernel/address_space.h>
+#include <kernel/paging.h>
+#include <kernel/vma.h>
+#include "host.h"
+
+Kernel kernel;
+bool host_verbose = false;
+
+static struct limine_memmap_entry hostMemmap[1];
+static struct limine_memmap_entry *hostMemmapPointers[1];
+
+void host_memory_init(uint64_t size) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    kernel.hhdm = (uint64_t)memory - HOST_PHYS_BASE;
+    hostMemmap[0].base = HOST_PHYS_BASE;
+    hostMemmap[0].length = size;
+    hostMemmap[0].type = LIMINE_MEMMAP_USABLE;
+    hostMemmapPointers[0] = &hostMemmap[0];
+    kernel.memmapEntries = hostMemmapPointers;
+    kernel.memmapEntryCount = 1;
+    initPMM();
+}
+
+int printk(const char* format, ...) {
+    if (!host_verbose)
+        return 0;
+    va_list args;
+    va_start(args, format);
+    int ret = vfprintf(stderr, format, args);
+    va_end(args);
+    return ret;
+}
+
+int kdebug(const char* format, ...) {
+    (void)format;
+    return 0;
+}
+
+// printf.c's _putchar lands here
+void terminal_write_char(char c) {
+    if (host_verbose)
+        fputc(c, stderr);
+}
+
+uint64_t rdtsc() {
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+}
+
+void *memset_nt(void *s, int c, size_t n) {
+    return memset(s, c, n);
+}
+
+void *simd_memset_nt(void *s, int c, size_t n) {
+    return memset(s, c, n);
+}
+
+void *simd_memcpy(void *dest, const void *src, size_t n) {
+    return memcpy(dest, src, n);
+}
+
+void* vmalloc(size_t size) {
+    return malloc(size);
+}
+
+void vfree(void* ptr) {
+    free(ptr);
+}
+
+// Address spaces are only their VMA lists here. vma.c maps what a fault fills in through address_space_map(),
+// which records the frame against the page so address_space_translate() finds it again; the frames are freed
+// in bulk between runs.
+struct hostMapping {
+    struct addressSpace *space;
+    uint64_t virt;
+    uint64_t frame;
+};
+
+static struct addressSpace *currentSpace = NULL;
+static struct hostMapping *mappings = NULL;
+static uint64_t mappedCount = 0;
+static uint64_t mappedCapacity = 0;
+
+struct addressSpace* address_space_create() {
+    return calloc(1, sizeof(struct addressSpace));
+}
+
+struct addressSpace* address_space_current() {
+    return currentSpace;
+}
+
+void address_space_switch(struct addressSpace *space) {
+    currentSpace = space;
+}
+
+void address_space_destroy(struct addressSpace *space) {
+    vma_destroy_all(space);
+    for (uint64_t i = 0; i < mappedCount; i++) {
+        if (mappings[i].space == space)
+            mappings[i].space = NULL;
+    }
+    if (currentSpace == space)
+        currentSpace = NULL;
+    free(space);
+}
+
+bool address_space_map(struct addressSpace *space, uint64_t virt_addr, const uint64_t *frames, uint64_t count,
+                       uint64_t flags) {
+    (void)flags;
+    for (uint64_t i = 0; i < count; i++) {
+        if (mappedCount == mappedCapacity) {
+            mappedCapacity = mappedCapacity ? mappedCapacity * 2 : 1024;
+            mappings = realloc(mappings, mappedCapacity * sizeof(*mappings));
+        }
+        mappings[mappedCount++] = (struct hostMapping){ space, virt_addr + i * PAGE_SIZE, frames[i] };
+    }
+    return true;
+}
+
+// The caller releases the frames itself, so they're only forgotten here.
+void address_space_unmap(struct addressSpace *space, uint64_t virt_addr, uint64_t count) {
+    for (uint64_t i = 0; i < mappedCount; ) {
+        if (mappings[i].space == space && mappings[i].virt >= virt_addr && mappings[i].virt < virt_addr + count * PAGE_SIZE)
+            mappings[i] = mappings[--mappedCount];
+        else
+            i++;
+    }
+}
+
+uint64_t address_space_translate(struct addressSpace *space, uint64_t virt_addr) {
+    for (uint64_t i = 0; i < mappedCount; i++) {
+        if (mappings[i].space == space && mappings[i].virt == (virt_addr & ~0xFFFULL))
+            return mappings[i].frame;
+    }
+    return 0;
+}
+
+// Nothing is shared copy-on-write on the host.
+bool address_space_write_fault(struct addressSpace *space, uint64_t virt_addr) {
+    (void)space;
+    (void)virt_addr;
+    return false;
+}
+
+uint64_t host_pages_mapped(void) {
+    return mappedCount;
+}
+
+void host_release_mapped_pages(void) {
+    for (uint64_t i = 0; i < mappedCount; i++)
+        free_pages(mappings[i].frame, 0);
+    mappedCount = 0;
+}
+
+// Sectors past the end of the image read as zeroes, like a blank disk.
+static uint8_t *diskImage = NULL;
+static uint64_t diskSize = 0;
+static uint8_t sectorBuffer[512];
+
+void host_disk_set(uint8_t *image, uint64_t size) {
+    diskImage = image;
+    diskSize = size;
+}
+
+uint8_t* readdisk_into(int32_t sect, uint8_t* buffer) {
+    uint64_t offset = (uint64_t)(uint32_t)sect * 512;
+    if (!diskImage || offset + 512 > diskSize)
+        memset(buffer, 0, 512);
+    else
+        memcpy(buffer, diskImage + offset, 512);
+    return buffer;
+}
+
+uint8_t* readdisk(int32_t sect) {
+    return readdisk_into(sect, sectorBuffer);
+}
@@ -8,9 +8,10 @@
 
 #include <kernel/kernel.h>
 #include <kernel/printk.h>
-#include <kernel/pmm.h>
+#include <kernel/slab.h>
 #include <arch/x64/tss.h>
 #include <arch/x64/gdt.h>
+#include <kernel/init.h>
 
 // define some shit
 
@@ -63,9 +64,9 @@ void loadGDT(struct GDTEntry *GDTAddress) {
     // anyway now let's just hope I don't get a gpf.
 }
 
-void initGDT() {
+__init void initGDT() {
     printk("[argaldOS:kernel:GDT] Trying to initialise Global Descriptor Table (GDT)...\n");
-    struct GDTEntry *GDT = (struct GDTEntry*) (kmalloc() + kernel.hhdm);
+    struct GDTEntry *GDT = (struct GDTEntry*) kmalloc(sizeof(struct GDTEntry) * 6);
     printk("[argaldOS:kernel:GDT] Initializing Task State Segment (TSS)...\n");
     initTSS();
     setGate(0, 0, 0, 0, 0, GDT); // first one's gotta be null
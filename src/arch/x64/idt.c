@@ -10,8 +10,9 @@
 #include <drivers/ports.h>
 #include <drivers/keyboard.h>
 #include <kernel/kernel.h>
-#include <kernel/pmm.h>
+#include <kernel/slab.h>
 #include <kernel/panic.h>
+#include <kernel/init.h>
 
 // and the thingies to make it do stuff
 
@@ -60,7 +61,7 @@ void idtSetDescriptor(uint8_t vect, void* isrThingy, uint8_t gateType, uint8_t d
 
 // define more stuff for PIC (hardware, yay!)
 
-void remapPIC() {
+__init void remapPIC() {
     printk("[argaldOS:kernel:IDT] Remapping Programmable Interrupt Controller (PIC)\n");
     // ICW1: Start initialization of PIC
     port_byte_out(0x20, 0x11); // Master PIC
@@ -201,7 +202,7 @@ void taskSwitchISR(void*) {
         asm("sti");
 }
 
-void initIRQ(struct IDTEntry *IDTAddr) {
+__init void initIRQ(struct IDTEntry *IDTAddr) {
     printk("[argaldOS:kernel:IDT] Populating Interrupt Service Requests on IDT table...\n");
     remapPIC();
     // map some stuff
@@ -238,9 +239,9 @@ void initIRQ(struct IDTEntry *IDTAddr) {
     idtSetDescriptor(20, &virtualisationException, 15, 0, IDTAddr);
 }
 
-void initIDT() {
+__init void initIDT() {
     printk("[argaldOS:kernel:IDT] Trying to initialise IDT & IRQs...\n");
-    struct IDTEntry *IDTAddr = (struct IDTEntry*) (kmalloc() + kernel.hhdm);
+    struct IDTEntry *IDTAddr = (struct IDTEntry*) kmalloc(sizeof(struct IDTEntry) * 256);
     kernel.IDTPtr.offset = (uintptr_t)IDTAddr;
     kernel.IDTPtr.size = ((uint16_t)sizeof(struct IDTEntry) *  256) - 1;
     printk("[argaldOS:kernel:IDT] Loading empty IDT table...\n");
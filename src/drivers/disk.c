@@ -148,7 +148,9 @@ uint8_t* accessDisk(int32_t sect, bool isWrite, uint8_t data[512]) {
             //}
         }
     }
-    static uint8_t buffer8[512];
+    // reads land in data when the caller gave a buffer, otherwise in this one, which is only good until the next read
+    static uint8_t sectorBuffer[512];
+    uint8_t *buffer8 = (!isWrite && data) ? data : sectorBuffer;
     if (isWrite) { 
         kdebug("Writing to disk: ");
         kdebug(data);
@@ -190,11 +192,15 @@ uint8_t* accessDisk(int32_t sect, bool isWrite, uint8_t data[512]) {
     return buffer8;
 }
 
-uint8_t emptyData[512];
-
 uint8_t* readdisk(int32_t sect) {
     kdebug("[DISK] readdisk\n");
-    return accessDisk(sect, false, emptyData);
+    return accessDisk(sect, false, NULL);
+}
+
+// Reads one sector straight into buffer (512 bytes), without going through the shared sector buffer.
+uint8_t* readdisk_into(int32_t sect, uint8_t* buffer) {
+    kdebug("[DISK] readdisk_into\n");
+    return accessDisk(sect, false, buffer);
 }
 
 void writedisk(int32_t sect, char* data) {
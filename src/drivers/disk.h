@@ -8,6 +8,7 @@
 
 
 char* readdisk(int32_t sect);
+uint8_t* readdisk_into(int32_t sect, uint8_t* buffer);
 // Expose accessDisk for direct disk sector access
 uint8_t* accessDisk(int32_t sect, bool isWrite, uint8_t data[512]);
 
@@ -33,6 +33,22 @@
 void *memset(void *, int, size_t);
 void *memcpy(void *, const void *, size_t);
 
+// Pixels are written with non-temporal stores so drawing text doesn't push the rest of the kernel out of
+// the cache; the framebuffer is never read back. Whatever draws must end with fb_fence().
+static inline void fb_store(volatile uint32_t *pixel, uint32_t value) {
+#if defined(__x86_64__)
+    asm volatile ("movnti %1, %0" : "=m"(*pixel) : "r"(value));
+#else
+    *pixel = value;
+#endif
+}
+
+static inline void fb_fence(void) {
+#if defined(__x86_64__)
+    asm volatile ("sfence" ::: "memory");
+#endif
+}
+
 #ifndef FLANTERM_FB_DISABLE_BUMP_ALLOC
 
 #ifndef FLANTERM_FB_BUMP_ALLOC_POOL_SIZE
@@ -467,7 +483,7 @@ static void plot_char(struct flanterm_context *_ctx, struct flanterm_fb_char *c,
                     bg = c->bg == 0xffffffff ? default_bg : c->bg;
                     fg = c->fg == 0xffffffff ? default_bg : c->fg;
                 }
-                fb_line[gx] = draw ? fg : bg;
+                fb_store(&fb_line[gx], draw ? fg : bg);
             }
         }
     }
@@ -507,7 +523,7 @@ static void plot_char_masked(struct flanterm_context *_ctx, struct flanterm_fb_c
                     bg = c->bg == 0xffffffff ? default_bg : c->bg;
                     fg = c->fg == 0xffffffff ? default_bg : c->fg;
                 }
-                fb_line[gx] = new_draw ? fg : bg;
+                fb_store(&fb_line[gx], new_draw ? fg : bg);
             }
         }
     }
@@ -784,6 +800,8 @@ static void flanterm_fb_double_buffer_flush(struct flanterm_context *_ctx) {
     ctx->old_cursor_y = ctx->cursor_y;
 
     ctx->queue_i = 0;
+
+    fb_fence();
 }
 
 static void flanterm_fb_raw_putchar(struct flanterm_context *_ctx, uint8_t c) {
@@ -816,9 +834,9 @@ static void flanterm_fb_full_refresh(struct flanterm_context *_ctx) {
     for (size_t y = 0; y < ctx->height; y++) {
         for (size_t x = 0; x < ctx->width; x++) {
             if (ctx->canvas != NULL) {
-                ctx->framebuffer[y * (ctx->pitch / sizeof(uint32_t)) + x] = ctx->canvas[y * ctx->width + x];
+                fb_store(&ctx->framebuffer[y * (ctx->pitch / sizeof(uint32_t)) + x], ctx->canvas[y * ctx->width + x]);
             } else {
-                ctx->framebuffer[y * (ctx->pitch / sizeof(uint32_t)) + x] = default_bg;
+                fb_store(&ctx->framebuffer[y * (ctx->pitch / sizeof(uint32_t)) + x], default_bg);
             }
         }
     }
@@ -833,6 +851,8 @@ static void flanterm_fb_full_refresh(struct flanterm_context *_ctx) {
     if (_ctx->cursor_enabled) {
         draw_cursor(_ctx);
     }
+
+    fb_fence();
 }
 
 static void flanterm_fb_deinit(struct flanterm_context *_ctx, void (*_free)(void *, size_t)) {
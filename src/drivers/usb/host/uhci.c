@@ -6,7 +6,10 @@
 #include <kernel/kernel.h>
 #include <kernel/printk.h>
 #include <kernel/io.h>
+#include <kernel/mem.h>
+#include <kernel/dma.h>
 #include <kernel/pmm.h>
+#include <kernel/pool.h>
 #include <kernel/timer.h>
 #include <stdlib/string.h>
 
@@ -106,154 +109,193 @@ bool uhci_port_reset(uint16_t base, uint8_t port) {
 }
 
 
-bool uhci_set_address(const uint16_t io_base, const uint32_t base, const int selector, const int dev_address, const bool ls_device) {
+// The schedule memory is one DMA buffer: the frame list in the first 4K, then the setup packet and the data
+// buffers. The controller sees it through mem->phys, we build it through mem->virt.
+// Queue heads and TD's come from pools below 4GiB, so they are recycled between transfers instead of rebuilt.
+#define UHCI_XFER_OFFSET 4096
+#define UHCI_MAX_TDS 10
 
-  // our setup packet (with the third byte replaced below)
-  static uint8_t setup_packet[8] = { 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-  int i, timeout;
+static struct objectPool *uhci_qh_pool = NULL;
+static struct objectPool *uhci_td_pool = NULL;
+// kept across uhci_init() calls, the controller is reset before it's rebuilt
+static struct dmaBuffer uhci_schedule = {0};
 
-  // one queue and two TD's
-  struct UHCI_QUEUE_HEAD queue;
-  struct UHCI_TRANSFER_DESCRIPTOR td[2];
+static void uhci_qh_ctor(void *object) {
+  struct UHCI_QUEUE_HEAD *queue = object;
+  memset(queue, 0, sizeof(*queue));
+  queue->horz_ptr = 0x00000001;
+  queue->vert_ptr = 0x00000001;
+}
 
-  setup_packet[2] = (uint8_t) dev_address;
+static void uhci_td_ctor(void *object) {
+  struct UHCI_TRANSFER_DESCRIPTOR *td = object;
+  memset(td, 0, sizeof(*td));
+  td->link_ptr = 0x00000001;
+}
+
+static volatile uint32_t* uhci_frame_list(const struct dmaBuffer *mem) {
+  return (volatile uint32_t*) mem->virt;
+}
 
-  queue.horz_ptr = 0x00000001;
-  queue.vert_ptr = (base + 4096 + 128 + sizeof(struct UHCI_QUEUE_HEAD));  // 128 to skip past buffers
+// Gets a queue head and count TD's from the pools, with the TD's linked one after the other below the queue.
+static bool uhci_get_transfer(volatile struct UHCI_QUEUE_HEAD **queue, volatile struct UHCI_TRANSFER_DESCRIPTOR **td, int count) {
+  *queue = pool_get(uhci_qh_pool);
+  if (!*queue) return false;
+  for (int i = 0; i < count; i++) {
+    td[i] = pool_get(uhci_td_pool);
+    if (!td[i]) {
+      while (i--) pool_put(uhci_td_pool, (void*) td[i]);
+      pool_put(uhci_qh_pool, (void*) *queue);
+      return false;
+    }
+  }
+  (*queue)->horz_ptr = 0x00000001;
+  (*queue)->vert_ptr = (uint32_t) pool_phys((void*) td[0]);
+  for (int i = 0; i < count - 1; i++) {
+    td[i]->link_ptr = (uint32_t) pool_phys((void*) td[i + 1]);
+  }
+  td[count - 1]->link_ptr = 0x00000001;
+  return true;
+}
 
-  td[0].link_ptr = ((queue.vert_ptr & ~0xF) + sizeof(struct UHCI_TRANSFER_DESCRIPTOR));
-  td[0].reply = (ls_device ? (1<<26) : 0) | (3<<27) | (0x80 << 16);
-  td[0].info = (7<<21) | (0<<8) | TOKEN_SETUP;
-  td[0].buff_ptr = base + 4096;
+static void uhci_put_transfer(volatile struct UHCI_QUEUE_HEAD *queue, volatile struct UHCI_TRANSFER_DESCRIPTOR **td, int count) {
+  for (int i = 0; i < count; i++) pool_put(uhci_td_pool, (void*) td[i]);
+  pool_put(uhci_qh_pool, (void*) queue);
+}
 
-  td[1].link_ptr = 0x00000001;
-  td[1].reply = (ls_device ? (1<<26) : 0) | (3<<27) | (1<<24) | (0x80 << 16);
-  td[1].info = (0x7FF<<21) | (1<<19) | (0<<8) | TOKEN_IN;
-  td[1].buff_ptr = 0x00000000;
+// Runs the queue from the first frame until the controller raises IOC, or gives up after 10 seconds.
+static bool uhci_run_queue(const uint16_t io_base, struct dmaBuffer *mem, volatile struct UHCI_QUEUE_HEAD *queue) {
+  int timeout;
 
   // make sure status:int bit is clear
-  io_write16(kernel.uhci_io_base_address + UHCI_IO_USBSTS_OFFSET, 1);
-
-  // now move our queue into the physicall memory allocated
-  //movedata(_my_ds(), (uint32_t) setup_packet, selector, 4096, 8);
-  //movedata(_my_ds(), (uint32_t) &queue, selector, 4096 + 128, sizeof(struct UHCI_QUEUE_HEAD));
-  //movedata(_my_ds(), (uint32_t) &td[0], selector, 4096 + 128 + sizeof(struct UHCI_QUEUE_HEAD), (sizeof(struct UHCI_TRANSFER_DESCRIPTOR) * 2));
+  io_write16(io_base + UHCI_IO_USBSTS_OFFSET, 1);
 
   // mark the first stack frame pointer
-  //_farpokel(selector, 0, (base + 4096 + 128) | QUEUE_HEAD_Q);
+  uhci_frame_list(mem)[0] = (uint32_t) pool_phys((void*) queue) | QUEUE_HEAD_Q;
 
   // wait for the IOC to happen
   timeout = 10000; // 10 seconds
-  while (!(io_read16(kernel.uhci_io_base_address + UHCI_IO_USBSTS_OFFSET) & 1) && (timeout > 0)) {
+  while (!(io_read16(io_base + UHCI_IO_USBSTS_OFFSET) & 1) && (timeout > 0)) {
     timeout--;
     mdelay(1);
   }
+  uhci_frame_list(mem)[0] = 1;  // mark the first stack frame pointer invalid
   if (timeout == 0) {
-    printk(" uhci_set_address:UHCI timed out...\n");
-    //_farpokel(selector, 0, 1);  // mark the first stack frame pointer invalid
     return false;
   }
-  io_write32(kernel.uhci_io_base_address + UHCI_IO_USBSTS_OFFSET, 1);  // acknowledge the interrupt
+  io_write16(io_base + UHCI_IO_USBSTS_OFFSET, 1);  // acknowledge the interrupt
+  return true;
+}
+
+bool uhci_set_address(const uint16_t io_base, struct dmaBuffer *mem, const int dev_address, const bool ls_device) {
+
+  // our setup packet (with the third byte replaced below)
+  static uint8_t setup_packet[8] = { 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  int i;
+  bool ok = true;
+  uint32_t base = (uint32_t) mem->phys;
+
+  // one queue and two TD's
+  volatile struct UHCI_QUEUE_HEAD *queue;
+  volatile struct UHCI_TRANSFER_DESCRIPTOR *td[2];
+  if (!uhci_get_transfer(&queue, td, 2)) {
+    printk(" uhci_set_address: out of TD's\n");
+    return false;
+  }
+
+  setup_packet[2] = (uint8_t) dev_address;
+  memcpy((uint8_t*) mem->virt + UHCI_XFER_OFFSET, setup_packet, 8);
 
-  //_farpokel(selector, 0, 1);  // mark the first stack frame pointer invalid
+  td[0]->reply = (ls_device ? (1<<26) : 0) | (3<<27) | (0x80 << 16);
+  td[0]->info = (7<<21) | (0<<8) | TOKEN_SETUP;
+  td[0]->buff_ptr = base + UHCI_XFER_OFFSET;
 
-  // copy the stack frame back to our local buffer
-  //movedata(selector, 4096 + 128, _my_ds(), (uint32_t) &queue, sizeof(struct UHCI_QUEUE_HEAD));
-  //movedata(selector, 4096 + 128 + sizeof(struct UHCI_QUEUE_HEAD), _my_ds(), (uint32_t) &td[0], (sizeof(struct UHCI_TRANSFER_DESCRIPTOR) * 2));
+  td[1]->reply = (ls_device ? (1<<26) : 0) | (3<<27) | (1<<24) | (0x80 << 16);
+  td[1]->info = (0x7FF<<21) | (1<<19) | (0<<8) | TOKEN_IN;
+  td[1]->buff_ptr = 0x00000000;
+
+  if (!uhci_run_queue(io_base, mem, queue)) {
+    printk(" uhci_set_address:UHCI timed out...\n");
+    ok = false;
+  }
 
   // check the TD's for error
-  for (i=0; i<2; i++) {
-    if ((td[i].reply & (0xFF<<16)) != 0) {
-      printk(" Found Error in TD #%i: 0x%08X\n", i, td[i].reply);
-      return false;
+  for (i=0; ok && i<2; i++) {
+    if ((td[i]->reply & (0xFF<<16)) != 0) {
+      printk(" Found Error in TD #%i: 0x%08X\n", i, td[i]->reply);
+      ok = false;
     }
   }
 
-  return true;
+  uhci_put_transfer(queue, td, 2);
+  return ok;
 }
 
 // set up a queue, and enough TD's to get 'size' bytes
-bool uhci_get_descriptor(const uint16_t io_base, const uint32_t base, const int selector, struct DEVICE_DESC *dev_desc, const bool ls_device, const int dev_address, const int packet_size, const int size) {
+bool uhci_get_descriptor(const uint16_t io_base, struct dmaBuffer *mem, struct DEVICE_DESC *dev_desc, const bool ls_device, const int dev_address, const int packet_size, const int size) {
   static uint8_t setup_packet[8] = { 0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 };
-  uint8_t our_buff[120];
-  int i = 1, t, sz = size, timeout;
+  uint8_t *our_buff = (uint8_t*) mem->virt + UHCI_XFER_OFFSET + 8;
+  int i = 1, t, sz = size, count = 2;
+  bool ok = true;
+  uint32_t base = (uint32_t) mem->phys;
+
+  // the setup TD, one IN TD per packet (at most 8) and the status TD
+  while ((sz > 0) && (count < UHCI_MAX_TDS)) {
+    sz -= (sz <= packet_size) ? sz : packet_size;
+    count++;
+  }
+  sz = size;
 
-  struct UHCI_QUEUE_HEAD queue;
-  struct UHCI_TRANSFER_DESCRIPTOR td[10];
+  volatile struct UHCI_QUEUE_HEAD *queue;
+  volatile struct UHCI_TRANSFER_DESCRIPTOR *td[UHCI_MAX_TDS];
+  if (!uhci_get_transfer(&queue, td, count)) {
+    printk(" uhci_get_descriptor: out of TD's\n");
+    return false;
+  }
 
   // set the size of the packet to return
   * ((uint16_t *) &setup_packet[6]) = (uint16_t) size;
 
-  //memset(our_buff, 0, 120);
+  memcpy((uint8_t*) mem->virt + UHCI_XFER_OFFSET, setup_packet, 8);
+  memset(our_buff, 0, 120);
 
-  queue.horz_ptr = 0x00000001;
-  queue.vert_ptr = (base + 4096 + 128 + sizeof(struct UHCI_QUEUE_HEAD));  // 128 to skip past buffers
+  td[0]->reply = (ls_device ? (1<<26) : 0) | (3<<27) | (0x80 << 16);
+  td[0]->info = (7<<21) | ((dev_address & 0x7F)<<8) | TOKEN_SETUP;
+  td[0]->buff_ptr = base + UHCI_XFER_OFFSET;
 
-  td[0].link_ptr = ((queue.vert_ptr & ~0xF) + sizeof(struct UHCI_TRANSFER_DESCRIPTOR));
-  td[0].reply = (ls_device ? (1<<26) : 0) | (3<<27) | (0x80 << 16);
-  td[0].info = (7<<21) | ((dev_address & 0x7F)<<8) | TOKEN_SETUP;
-  td[0].buff_ptr = base + 4096;
-
-  while ((sz > 0) && (i<9)) {
-    td[i].link_ptr = ((td[i-1].link_ptr & ~0xF) + sizeof(struct UHCI_TRANSFER_DESCRIPTOR));
-    td[i].reply = (ls_device ? (1<<26) : 0) | (3<<27) | (0x80 << 16);
+  while (i < count - 1) {
+    td[i]->reply = (ls_device ? (1<<26) : 0) | (3<<27) | (0x80 << 16);
     t = ((sz <= packet_size) ? sz : packet_size);
-    td[i].info = ((t-1)<<21) | ((i & 1) ? (1<<19) : 0) | ((dev_address & 0x7F)<<8) | TOKEN_IN;
-    td[i].buff_ptr = base + 4096 + (8 * i);
+    td[i]->info = ((t-1)<<21) | ((i & 1) ? (1<<19) : 0) | ((dev_address & 0x7F)<<8) | TOKEN_IN;
+    td[i]->buff_ptr = base + UHCI_XFER_OFFSET + (8 * i);
     sz -= t;
     i++;
   }
 
-  td[i].link_ptr = 0x00000001;
-  td[i].reply = (ls_device ? (1<<26) : 0) | (3<<27) | (1<<24) | (0x80 << 16);
-  td[i].info = (0x7FF<<21) | (1<<19) | ((dev_address & 0x7F)<<8) | TOKEN_OUT;
-  td[i].buff_ptr = 0x00000000;
-  i++; // for a total count
-
-  // make sure status:int bit is clear
-  io_write16(io_base + UHCI_IO_USBSTS_OFFSET, 1);
-
-  // now move our queue into the physical memory allocated
-  //movedata(_my_ds(), (uint32_t) setup_packet, selector, 4096 + 0, 8);
-  //movedata(_my_ds(), (uint32_t) our_buff, selector, 4096 + 8, 120);
-  //movedata(_my_ds(), (uint32_t) &queue, selector, 4096 + 128, sizeof(struct UHCI_QUEUE_HEAD));
-  //movedata(_my_ds(), (uint32_t) &td[0], selector, 4096 + 128 + sizeof(struct UHCI_QUEUE_HEAD), sizeof(struct UHCI_TRANSFER_DESCRIPTOR) * 10);
-
-  // mark the first stack frame pointer
-  //_farpokel(selector, 0, (base + 4096 + 128) | QUEUE_HEAD_Q);
+  td[i]->reply = (ls_device ? (1<<26) : 0) | (3<<27) | (1<<24) | (0x80 << 16);
+  td[i]->info = (0x7FF<<21) | (1<<19) | ((dev_address & 0x7F)<<8) | TOKEN_OUT;
+  td[i]->buff_ptr = 0x00000000;
 
-  // wait for the IOC to happen
-  timeout = 10000; // 10 seconds
-  while (!(io_read16(io_base + UHCI_IO_USBSTS_OFFSET) & 1) && (timeout > 0)) {
-    timeout--;
-    mdelay(1);
-  }
-  if (timeout == 0) {
+  if (!uhci_run_queue(io_base, mem, queue)) {
     printk(" uhci_get_descriptor:UHCI timed out...\n");
-    //_farpokel(selector, 0, 1);  // mark the first stack frame pointer invalid
-    return false;
+    ok = false;
   }
-  io_write16(io_base + UHCI_IO_USBSTS_OFFSET, 1);  // acknowledge the interrupt
-
-  //_farpokel(selector, 0, 1);  // mark the first stack frame pointer invalid
-
-  // copy the stack frame back to our local buffer
-  //movedata(selector, 4096+8, _my_ds(), (uint32_t) our_buff, 120);
-  //movedata(selector, 4096 + 128, _my_ds(), (uint32_t) &queue, sizeof(struct UHCI_QUEUE_HEAD));
-  //movedata(selector, 4096 + 128 + sizeof(struct UHCI_QUEUE_HEAD), _my_ds(), (uint32_t) &td[0], (sizeof(struct UHCI_TRANSFER_DESCRIPTOR) * 10));
 
   // check the TD's for error
-  for (t=0; t<i; t++) {
-    if (((td[t].reply & (0xFF<<16)) != 0)) {
-      printk(" Found Error in TD #%i: 0x%08X\n", t, td[t].reply);
-      return false;
+  for (t=0; ok && t<count; t++) {
+    if (((td[t]->reply & (0xFF<<16)) != 0)) {
+      printk(" Found Error in TD #%i: 0x%08X\n", t, td[t]->reply);
+      ok = false;
     }
   }
+  uhci_put_transfer(queue, td, count);
 
   // copy the descriptor to the passed memory block
-//memcpy(dev_desc, our_buff, size);
+  if (ok) {
+    memcpy(dev_desc, our_buff, size);
+  }
 
-  return true;
+  return ok;
 }
 
 void uhci_init() {
@@ -280,15 +322,28 @@ void uhci_init() {
                // if it gets here, means that UHCI controller is working OK
                printk("[argaldOS:kernel:DRV:USB] USB Host Controller reset and in working condition\n");
                
-               uint8_t* ptr = (uint8_t*) kmalloc();  // reserving a 8K memory page
-               uint64_t address = (uint64_t)( ptr + kernel.hhdm );
+               // reserving 8K of memory the controller can reach: its pointers are only 32 bit wide
+               // and the frame list has to be 4K aligned
+               if (!uhci_schedule.phys) uhci_schedule = dma_alloc(8192, 4096, 0xFFFFFFFF);
+               struct dmaBuffer schedule = uhci_schedule;
+               // queue heads and TD's have to be 16 byte aligned and reachable with 32 bit pointers too
+               if (!uhci_qh_pool) uhci_qh_pool = pool_create_zone(sizeof(struct UHCI_QUEUE_HEAD), 16, uhci_qh_ctor, ZONE_DMA32);
+               if (!uhci_td_pool) uhci_td_pool = pool_create_zone(sizeof(struct UHCI_TRANSFER_DESCRIPTOR), 16, uhci_td_ctor, ZONE_DMA32);
+               if (!schedule.phys || !uhci_qh_pool || !uhci_td_pool) {
+                  printk("[argaldOS:kernel:DRV:USB] ERROR: no memory below 4GiB for the frame list\n");
+                  dma_free(&uhci_schedule);
+                  return;
+               }
                char buf[20];
-               uint64_to_hex_string(address,buf);
+               uint64_to_hex_string(schedule.phys,buf);
                printk("Mem 0x%s\n",buf);
+               // every frame starts out empty (terminate bit set)
+               for (int frame = 0; frame < 1024; frame++)
+                     uhci_frame_list(&schedule)[frame] = 1;
 
                printk("[argaldOS:kernel:DRV:USB] USB Host Controller configuration\n");
                // Setting the host controller schedule configuration
-               io_write32(kernel.uhci_io_base_address + UHCI_IO_FRBASEADD_OFFSET, address); // physical address
+               io_write32(kernel.uhci_io_base_address + UHCI_IO_FRBASEADD_OFFSET, schedule.phys); // physical address
                io_write16(kernel.uhci_io_base_address + UHCI_IO_FRNUM_OFFSET, 0x00);        // start af frame 0
                io_write8(kernel.uhci_io_base_address + UHCI_IO_SOFMOD_OFFSET, 0x40);        // start of frame to default
                io_write16(kernel.uhci_io_base_address + UHCI_IO_USBINTR_OFFSET, 0x0000);    // disallow error interrupts
@@ -300,10 +355,13 @@ void uhci_init() {
                      printk("An USB device is present in port 0x10\n");
                      uhci_port_reset(kernel.uhci_io_base_address,0x10);
                      printk("After resetting the port\n");
-                     if (uhci_set_address(kernel.uhci_io_base_address,address,1,dev_address,true)) {
+                     if (uhci_set_address(kernel.uhci_io_base_address,&schedule,dev_address,true)) {
                         printk("Set address\n");
                      }
-                     if (uhci_get_descriptor(kernel.uhci_io_base_address,address,1,&dev_desc,true,dev_address, dev_desc.max_packet_size, dev_desc.len)) {
+                     // the first read only asks for the 8 bytes every device can send in one packet
+                     dev_desc.max_packet_size = 8;
+                     dev_desc.len = 8;
+                     if (uhci_get_descriptor(kernel.uhci_io_base_address,&schedule,&dev_desc,true,dev_address, dev_desc.max_packet_size, dev_desc.len)) {
                         printk("get_descriptor\n");
                      }
 
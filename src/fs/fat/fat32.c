@@ -6,6 +6,8 @@
 #include <ctype.h>
 //#include <kernel/pmm.h>
 #include  <kernel/mem.h>
+#include <kernel/vmalloc.h>
+#include <kernel/pool.h>
 
 
 FAT fat = {0};
@@ -17,9 +19,9 @@ void fat32_init() {
 uint32_t get_next_cluster(int cluster) {
         uint16_t first_fat_sector = fat.ebpb.reserved_sectors;
         uint8_t fat_table[512];
-        uint8_t fat_offset = cluster * 4;
-        uint8_t fat_sector = first_fat_sector + (fat_offset / 512);
-        uint8_t ent_offset = fat_offset % 512;
+        uint32_t fat_offset = cluster * 4;
+        uint32_t fat_sector = first_fat_sector + (fat_offset / 512);
+        uint32_t ent_offset = fat_offset % 512;
         char* fat_contents = readdisk(fat_sector);
         for(int i=0;i<512;i++) {
                 fat_table[i] = fat_contents[i];
@@ -45,13 +47,30 @@ uint32_t get_first_sector_of_cluster(int cluster) {
         return sector;
 }
 
-DIR_ENTRY_LIST parse_directory_sector(char* directory_sector) {
-    DIR_ENTRY_LIST entry_list;
-    entry_list.size = 0;
+// directory listings are too big for the stack of every lookup, so they are recycled through a pool
+static struct objectPool *dir_entry_list_pool = NULL;
+
+static void dir_entry_list_ctor(void* object) {
+    ((DIR_ENTRY_LIST*)object)->size = 0;
+}
+
+static void free_directory_list(DIR_ENTRY_LIST* entry_list) {
+    entry_list->size = 0; // back to the constructed state
+    pool_put(dir_entry_list_pool, entry_list);
+}
+
+// Returns the entries of a directory sector, to be given back with free_directory_list(), or NULL.
+DIR_ENTRY_LIST* parse_directory_sector(char* directory_sector) {
     if (!directory_sector) {
         kdebug("parse_directory_sector: NULL directory_sector\n");
-        return entry_list;
+        return NULL;
+    }
+    if (!dir_entry_list_pool) {
+        dir_entry_list_pool = pool_create(sizeof(DIR_ENTRY_LIST), 8, dir_entry_list_ctor);
+        if (!dir_entry_list_pool) return NULL;
     }
+    DIR_ENTRY_LIST* entry_list = pool_get(dir_entry_list_pool);
+    if (!entry_list) return NULL;
     char* dir_entries[16];
     int entries = 0;
     for (int i = 0; i < 16; i++) { dir_entries[i] = &directory_sector[i * 32]; }
@@ -68,9 +87,9 @@ DIR_ENTRY_LIST parse_directory_sector(char* directory_sector) {
                 dir_entry.dir_first_cluster_low = ((uint16_t)dir_entries[i][DIR_ENTRY_DIR_FIRST_CLUSTER_LOW_OFFSET + 1] << 8 | dir_entries[i][DIR_ENTRY_DIR_FIRST_CLUSTER_LOW_OFFSET]);
                 dir_entry.dir_file_size = combine32bit(dir_entries[i][DIR_ENTRY_DIR_FILE_SIZE_OFFSET + 3], dir_entries[i][DIR_ENTRY_DIR_FILE_SIZE_OFFSET + 2], dir_entries[i][DIR_ENTRY_DIR_FILE_SIZE_OFFSET + 1], dir_entries[i][DIR_ENTRY_DIR_FILE_SIZE_OFFSET]);
                 dir_entry.dir_first_cluster = combine32bit(dir_entries[i][DIR_ENTRY_DIR_FIRST_CLUSTER_HIGH_OFFSET + 1], dir_entries[i][DIR_ENTRY_DIR_FIRST_CLUSTER_HIGH_OFFSET], dir_entries[i][DIR_ENTRY_DIR_FIRST_CLUSTER_LOW_OFFSET + 1], dir_entries[i][DIR_ENTRY_DIR_FIRST_CLUSTER_LOW_OFFSET]);
-                if (entries < (int)(sizeof(entry_list.list) / sizeof(entry_list.list[0]))) {
-                    entry_list.list[entries++] = dir_entry;
-                    entry_list.size = entries;
+                if (entries < (int)(sizeof(entry_list->list) / sizeof(entry_list->list[0]))) {
+                    entry_list->list[entries++] = dir_entry;
+                    entry_list->size = entries;
                 } else {
                     kdebug("parse_directory_sector: entry_list overflow\n");
                 }
@@ -83,47 +102,100 @@ DIR_ENTRY_LIST parse_directory_sector(char* directory_sector) {
     return entry_list;
 }
 
-uint8_t* read_file(char* filename, uint8_t* buffer, int size) {
+// Looks filename up in the root directory.
+static bool find_file(char* filename, DIR_ENTRY* entry) {
       read_ebpb();
       uint32_t sector = get_first_sector_of_cluster(fat.ebpb.cluster_number_of_root_directory);
       uint8_t* directory_sector = readdisk(sector);
-      DIR_ENTRY_LIST dir_entry_list = parse_directory_sector(directory_sector);
-      kdebug("Number of directory entries: %d\n", dir_entry_list.size);
-      for(int i=0;i<dir_entry_list.size;i++) {
-         trim(dir_entry_list.list[i].dir_name);
-         trim(dir_entry_list.list[i].dir_extension);
-         if (strcmp(filename,dir_entry_list.list[i].dir_name)) {
-            kdebug("dir name: [%s]\n", dir_entry_list.list[i].dir_name);
-            kdebug("dir extension: [%s]\n",dir_entry_list.list[i].dir_extension);
-            kdebug("dir file size: %zu\n\n",dir_entry_list.list[i].dir_file_size);
-            kdebug("dir first cluster high: %04X\n", dir_entry_list.list[i].dir_first_cluster_high);
-            kdebug("dir first cluster low: %04X\n", dir_entry_list.list[i].dir_first_cluster_low);
-            kdebug("dir first cluster: %zu\n", dir_entry_list.list[i].dir_first_cluster);
-            //uint8_t buffer[(dir_entry_list.list[i].dir_file_size % 512 > 0)?((dir_entry_list.list[i].dir_file_size / 512 ) + 1 ) * 512:(dir_entry_list.list[i].dir_file_size / 512) * 512];
-            //uint8_t* buffer = (uint8_t*) kmalloc();
-            kdebug("size of buffer: %d\n",sizeof(buffer));
-            int k=0;
-            int current_cluster = dir_entry_list.list[i].dir_first_cluster_low;
-            while(1) {
-               kdebug("reading cluster %d\n",current_cluster);
-               int sector = get_first_sector_of_cluster(current_cluster);
-               kdebug("reading sector: %d\n",sector);
-               uint8_t* sector_contents = (uint8_t*)readdisk(get_first_sector_of_cluster(current_cluster));
-               for (int j=0;j<512;j++) { 
-                       buffer[j+k] = (uint8_t)sector_contents[j];
-               }
-               current_cluster = get_next_cluster(current_cluster);
-               if (current_cluster == 0) {
-                  break;
-               } else {
-                       k += 512;
-               }
-            }
-            //return buffer; // found
-            return buffer; // found
+      DIR_ENTRY_LIST* dir_entry_list = parse_directory_sector(directory_sector);
+      if (!dir_entry_list) {
+         return false;
+      }
+      kdebug("Number of directory entries: %d\n", dir_entry_list->size);
+      bool found = false;
+      for(int i=0;i<dir_entry_list->size;i++) {
+         trim(dir_entry_list->list[i].dir_name);
+         trim(dir_entry_list->list[i].dir_extension);
+         if (strcmp(filename,dir_entry_list->list[i].dir_name)) {
+            kdebug("dir name: [%s]\n", dir_entry_list->list[i].dir_name);
+            kdebug("dir extension: [%s]\n",dir_entry_list->list[i].dir_extension);
+            kdebug("dir file size: %zu\n\n",dir_entry_list->list[i].dir_file_size);
+            kdebug("dir first cluster high: %04X\n", dir_entry_list->list[i].dir_first_cluster_high);
+            kdebug("dir first cluster low: %04X\n", dir_entry_list->list[i].dir_first_cluster_low);
+            kdebug("dir first cluster: %zu\n", dir_entry_list->list[i].dir_first_cluster);
+            *entry = dir_entry_list->list[i];
+            found = true;
+            break;
+         }
+      }
+      free_directory_list(dir_entry_list);
+      return found;
+}
+
+// Follows the cluster chain from first_cluster, copying at most size bytes into buffer.
+static void read_clusters(int first_cluster, uint8_t* buffer, int size) {
+      int k=0;
+      int current_cluster = first_cluster;
+      while(k < size) {
+         kdebug("reading cluster %d\n",current_cluster);
+         int sector = get_first_sector_of_cluster(current_cluster);
+         kdebug("reading sector: %d\n",sector);
+         if (size - k >= 512) {
+            readdisk_into(sector, buffer + k);
+         } else {
+            // partial tail, only part of the sector fits in buffer
+            uint8_t* sector_contents = (uint8_t*)readdisk(sector);
+            memcpy(buffer + k, sector_contents, size - k);
          }
+         current_cluster = get_next_cluster(current_cluster);
+         if (current_cluster == 0) {
+            break;
+         }
+         k += 512;
+      }
+}
+
+uint8_t* read_file(char* filename, uint8_t* buffer, int size) {
+      DIR_ENTRY entry;
+      if (!find_file(filename, &entry)) {
+         return NULL;
+      }
+      read_clusters(entry.dir_first_cluster_low, buffer, size);
+      return buffer; // found
+}
+
+// Reads a whole file into a buffer from vmalloc, so it doesn't need to fit on the stack or in one buddy block.
+// The caller vfree()s it. Returns NULL if the file isn't there.
+uint8_t* load_file(char* filename, uint32_t* size) {
+      DIR_ENTRY entry;
+      if (!find_file(filename, &entry)) {
+         return NULL;
+      }
+      // whole sectors are copied, so round up to one
+      uint32_t buffer_size = ((entry.dir_file_size + 511) / 512) * 512;
+      uint8_t* buffer = vmalloc(buffer_size ? buffer_size : 512);
+      if (!buffer) {
+         return NULL;
+      }
+      read_clusters(entry.dir_first_cluster_low, buffer, buffer_size);
+      *size = entry.dir_file_size;
+      return buffer;
+}
+
+// Same as load_file(), with the buffer coming from arena, so it goes away with the rest of the request.
+uint8_t* load_file_arena(struct arena* arena, char* filename, uint32_t* size) {
+      DIR_ENTRY entry;
+      if (!find_file(filename, &entry)) {
+         return NULL;
+      }
+      uint32_t buffer_size = ((entry.dir_file_size + 511) / 512) * 512;
+      uint8_t* buffer = arena_alloc(arena, buffer_size ? buffer_size : 512);
+      if (!buffer) {
+         return NULL;
       }
-      return directory_sector;
+      read_clusters(entry.dir_first_cluster_low, buffer, buffer_size);
+      *size = entry.dir_file_size;
+      return buffer;
 }
 
 EBPB read_ebpb() {
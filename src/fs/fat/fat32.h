@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <kernel/arena.h>
 
 #ifndef FAT32_H
 #define FAT32_H
@@ -134,5 +135,7 @@ void fat32_init();
 EBPB read_ebpb();
 void print_fat32_ebpb();
 uint8_t* read_file(char* filename, uint8_t* buffer, int size);
+uint8_t* load_file(char* filename, uint32_t* size);
+uint8_t* load_file_arena(struct arena* arena, char* filename, uint32_t* size);
 
 #endif
@@ -0,0 +1,116 @@
+/* Address spaces: a PML4 of their own, with the kernel half shared and the user half private.
+ * The kernel half entries point at the same PDPTs in every address space, so kernel mappings made after a space
+ * was created show up in it too. Tearing a space down walks only its user half, freeing the frames mapped there
+ * and the tables that held them.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/printk.h>
+#include <kernel/cpu.h>
+#include <kernel/slab.h>
+#include <kernel/paging.h>
+#include <kernel/tlb.h>
+#include <kernel/init.h>
+#include <kernel/vma.h>
+#include <kernel/address_space.h>
+
+static struct addressSpace kernelSpace = { .pml4 = 0, .tlb = TLB_CONTEXT_KERNEL, .vmas = NULL };
+// what each CPU has loaded
+static struct addressSpace *currentSpace[MAX_CPUS];
+
+__init void address_space_init() {
+    kernelSpace.pml4 = paging_kernel_root();
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+        currentSpace[cpu] = &kernelSpace;
+}
+
+struct addressSpace* address_space_kernel() {
+    return &kernelSpace;
+}
+
+struct addressSpace* address_space_current() {
+    return currentSpace[this_cpu()];
+}
+
+// An address space with nothing in its user half, or NULL.
+struct addressSpace* address_space_create() {
+    struct addressSpace *space = kmalloc(sizeof(*space));
+    if (!space)
+        return NULL;
+    space->pml4 = paging_new_root();
+    if (!space->pml4) {
+        kfree(space);
+        return NULL;
+    }
+    // generation 0 never matches, the first switch hands out a PCID
+    space->tlb.generation = 0;
+    space->tlb.pcid = 0;
+    space->vmas = NULL;
+    return space;
+}
+
+// An address space whose user half maps everything src's does, copy-on-write, with the same VMAs, or NULL.
+// It costs the page tables, the pages themselves are only copied as one side or the other writes to them.
+struct addressSpace* address_space_clone(struct addressSpace *src) {
+    struct addressSpace *space = kmalloc(sizeof(*space));
+    if (!space)
+        return NULL;
+    space->pml4 = paging_clone_root(src->pml4, &src->tlb);
+    if (!space->pml4) {
+        kfree(space);
+        return NULL;
+    }
+    space->tlb.generation = 0;
+    space->tlb.pcid = 0;
+    space->vmas = NULL;
+    if (!vma_clone_all(space, src)) {
+        address_space_destroy(space);
+        return NULL;
+    }
+    return space;
+}
+
+void address_space_destroy(struct addressSpace *space) {
+    if (!space || space == &kernelSpace)
+        return;
+    if (space == address_space_current()) {
+        printk("[argaldOS:kernel:COR:VMM] destroying the loaded address space, switching to the kernel's\n");
+        address_space_switch(&kernelSpace);
+    }
+    // its frames go back to the PMM next, nothing may still reach them through its PCID
+    tlb_flush_context(&space->tlb);
+    vma_destroy_all(space);
+    paging_free_root(space->pml4);
+    kfree(space);
+}
+
+void address_space_switch(struct addressSpace *space) {
+    uint64_t flags = irq_save();
+    if (currentSpace[this_cpu()] != space) {
+        paging_switch(space->pml4, &space->tlb);
+        currentSpace[this_cpu()] = space;
+    }
+    irq_restore(flags);
+}
+
+// Maps count pages from virt_addr to frames[0], frames[1], ... in space, which needn't be the loaded one.
+// The frames belong to space from then on, address_space_destroy() frees them.
+bool address_space_map(struct addressSpace *space, uint64_t virt_addr, const uint64_t *frames, uint64_t count,
+                       uint64_t flags) {
+    return map_page_list_in(space->pml4, &space->tlb, virt_addr, frames, count, flags);
+}
+
+// Takes count pages out of space. Their frames are not freed, they go back to whoever unmapped them.
+void address_space_unmap(struct addressSpace *space, uint64_t virt_addr, uint64_t count) {
+    unmap_pages_in(space->pml4, &space->tlb, virt_addr, count);
+}
+
+uint64_t address_space_translate(struct addressSpace *space, uint64_t virt_addr) {
+    return virt_to_phys_in(space->pml4, virt_addr);
+}
+
+// A write to a present page of space, the loaded one. True if it was copy-on-write and may now be retried.
+bool address_space_write_fault(struct addressSpace *space, uint64_t virt_addr) {
+    return paging_cow_fault(space->pml4, &space->tlb, virt_addr);
+}
@@ -0,0 +1,31 @@
+/* Header for ../address_space.c, one set of page tables per program.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/tlb.h>
+#include <kernel/vma.h>
+
+#ifndef ADDRESS_SPACE_H
+#define ADDRESS_SPACE_H
+
+struct addressSpace {
+    uint64_t pml4; // physical address of the top level table
+    struct tlbContext tlb;
+    struct vma *vmas; // reserved ranges, backed as they're touched
+};
+
+void address_space_init();
+struct addressSpace* address_space_kernel();
+struct addressSpace* address_space_current();
+struct addressSpace* address_space_create();
+struct addressSpace* address_space_clone(struct addressSpace *src);
+void address_space_destroy(struct addressSpace *space);
+void address_space_switch(struct addressSpace *space);
+bool address_space_map(struct addressSpace *space, uint64_t virt_addr, const uint64_t *frames, uint64_t count,
+                       uint64_t flags);
+void address_space_unmap(struct addressSpace *space, uint64_t virt_addr, uint64_t count);
+uint64_t address_space_translate(struct addressSpace *space, uint64_t virt_addr);
+bool address_space_write_fault(struct addressSpace *space, uint64_t virt_addr);
+
+#endif
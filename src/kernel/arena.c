@@ -0,0 +1,98 @@
+/* Arenas: allocations are a pointer bump inside a block of frames from the PMM, and are never freed one by one.
+ * arena_reset() drops everything at once, keeping the first chunk for the next round, and arena_end() gives all
+ * of it back. Meant for memory that lives exactly as long as one command or one request.
+ * An arena is not locked, it belongs to whoever is running the request.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <kernel/kernel.h>
+#include <kernel/printk.h>
+#include <kernel/pmm.h>
+#include <kernel/arena.h>
+
+#define ARENA_PAGE_SIZE 4096
+#define ARENA_CHUNK_ORDER 2 // 16 KiB chunks unless an allocation needs more
+#define ARENA_ALIGN 16
+
+// sits at the start of every chunk
+struct arenaChunk {
+    struct arenaChunk *next;
+    uint8_t order;
+};
+
+#define ARENA_HEADER_SIZE ((sizeof(struct arenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void arena_begin(struct arena *arena) {
+    arena->chunks = NULL;
+    arena->cursor = NULL;
+    arena->limit = NULL;
+}
+
+static void use_chunk(struct arena *arena, struct arenaChunk *chunk) {
+    arena->cursor = (uint8_t*)chunk + ARENA_HEADER_SIZE;
+    arena->limit = (uint8_t*)chunk + ((size_t)ARENA_PAGE_SIZE << chunk->order);
+}
+
+static bool add_chunk(struct arena *arena, size_t size) {
+    uint8_t order = ARENA_CHUNK_ORDER;
+    while (((size_t)ARENA_PAGE_SIZE << order) < size + ARENA_HEADER_SIZE)
+        order++;
+    if (order >= PMM_MAX_ORDER) {
+        printk("[ARENA] arena_alloc: %d bytes won't fit in a chunk\n", size);
+        return false;
+    }
+    uint64_t phys = alloc_pages(order);
+    if (!phys)
+        return false;
+    struct arenaChunk *chunk = (struct arenaChunk*)(phys + kernel.hhdm);
+    chunk->order = order;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    use_chunk(arena, chunk);
+    return true;
+}
+
+// Returns size bytes aligned to 16, valid until the next arena_reset() or arena_end(), or NULL.
+void* arena_alloc(struct arena *arena, size_t size) {
+    uint8_t *start = (uint8_t*)(((uint64_t)arena->cursor + ARENA_ALIGN - 1) & ~(uint64_t)(ARENA_ALIGN - 1));
+    if (!arena->cursor || size > (size_t)(arena->limit - start)) {
+        // whatever is left in the current chunk is given up
+        if (!add_chunk(arena, size))
+            return NULL;
+        start = arena->cursor;
+    }
+    arena->cursor = start + size;
+    return start;
+}
+
+// Frees every allocation at once. The oldest chunk is kept if it's a normal sized one, since the next
+// request will most likely need it again.
+void arena_reset(struct arena *arena) {
+    struct arenaChunk *chunk = arena->chunks;
+    struct arenaChunk *keep = NULL;
+    while (chunk) {
+        struct arenaChunk *next = chunk->next;
+        if (!next && chunk->order == ARENA_CHUNK_ORDER) {
+            keep = chunk;
+        } else {
+            free_pages((uint64_t)chunk - kernel.hhdm, chunk->order);
+        }
+        chunk = next;
+    }
+    arena->chunks = keep;
+    if (keep) {
+        use_chunk(arena, keep);
+    } else {
+        arena->cursor = NULL;
+        arena->limit = NULL;
+    }
+}
+
+void arena_end(struct arena *arena) {
+    arena_reset(arena);
+    if (arena->chunks)
+        free_pages((uint64_t)arena->chunks - kernel.hhdm, arena->chunks->order);
+    arena_begin(arena);
+}
@@ -0,0 +1,23 @@
+/* Header for ../arena.c, bump allocation for request scoped scratch memory.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef ARENA_H
+#define ARENA_H
+
+struct arenaChunk;
+
+struct arena {
+    struct arenaChunk *chunks; // newest first
+    uint8_t *cursor;
+    uint8_t *limit;
+};
+
+void arena_begin(struct arena *arena);
+void* arena_alloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_end(struct arena *arena);
+
+#endif
@@ -0,0 +1,99 @@
+/* Microbenchmark runner.
+ * Each benchmark gets BENCH_WARMUP untimed calls, then BENCH_ITERATIONS calls timed one by one between
+ * serialising TSC reads, with the cost of the reads themselves taken off. Results go to the console, and as
+ * CSV lines starting with "bench," to the serial port whether or not kernel serial output is on, so a host
+ * can collect them from the QEMU serial log.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib/string.h>
+#include <stdlib/printf.h>
+#include <kernel/printk.h>
+#include <drivers/serial.h>
+#include <kernel/bench.h>
+
+#define BENCH_WARMUP 16
+#define BENCH_ITERATIONS 256
+
+extern struct benchCase __bench_start[];
+extern struct benchCase __bench_end[];
+
+static uint64_t samples[BENCH_ITERATIONS];
+
+// lfence on both sides keeps the timed code from leaking out of the measured window
+static inline uint64_t bench_cycles(void) {
+    uint32_t lo, hi;
+    asm volatile ("lfence\n\trdtsc\n\tlfence" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static void sort_samples(uint64_t *values, int count) {
+    for (int i = 1; i < count; i++) {
+        uint64_t value = values[i];
+        int j = i - 1;
+        for (; j >= 0 && values[j] > value; j--)
+            values[j + 1] = values[j];
+        values[j + 1] = value;
+    }
+}
+
+// the cheapest back to back pair of TSC reads, subtracted from every sample
+static uint64_t timer_overhead(void) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 64; i++) {
+        uint64_t start = bench_cycles();
+        uint64_t end = bench_cycles();
+        if (end - start < best)
+            best = end - start;
+    }
+    return best;
+}
+
+static void run_case(struct benchCase *bench, uint64_t overhead) {
+    size_t bytes = bench->setup ? bench->setup() : 0;
+    for (int i = 0; i < BENCH_WARMUP; i++)
+        bench->body();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        uint64_t start = bench_cycles();
+        bench->body();
+        uint64_t elapsed = bench_cycles() - start;
+        samples[i] = elapsed > overhead ? elapsed - overhead : 0;
+    }
+    sort_samples(samples, BENCH_ITERATIONS);
+    uint64_t min = samples[0];
+    uint64_t median = samples[BENCH_ITERATIONS / 2];
+    uint64_t p99 = samples[BENCH_ITERATIONS * 99 / 100];
+
+    // no floating point in the kernel, cycles per byte is kept in hundredths
+    uint64_t cpb = bytes ? median * 100 / bytes : 0;
+    printk("%-20s min %-8zu median %-8zu p99 %-8zu", bench->name, min, median, p99);
+    if (bytes)
+        printk(" %zu.%02zu cycles/byte", cpb / 100, cpb % 100);
+    printk("\n");
+
+    char line[128];
+    snprintf(line, sizeof(line), "bench,%s,%d,%zu,%zu,%zu,%zu,%zu.%02zu\n", bench->name, BENCH_ITERATIONS,
+             min, median, p99, bytes, cpb / 100, cpb % 100);
+    writeserial(line);
+}
+
+bool bench_run(const char *name) {
+    uint64_t overhead = timer_overhead();
+    bool found = false;
+    writeserial("bench,name,iterations,min,median,p99,bytes,cycles_per_byte\n");
+    for (struct benchCase *bench = __bench_start; bench < __bench_end; bench++) {
+        if (name && !strcmp(name, bench->name))
+            continue;
+        run_case(bench, overhead);
+        found = true;
+    }
+    return found;
+}
+
+void bench_list() {
+    for (struct benchCase *bench = __bench_start; bench < __bench_end; bench++)
+        printk(" %s", bench->name);
+    printk("\n");
+}
@@ -0,0 +1,28 @@
+/* Header for ../bench.c, in-kernel microbenchmarks.
+ * BENCH(name, setup, body) registers a benchmark in the .bench linker section. setup runs once before the
+ * warm-up and returns how many bytes one call of body processes (0 when bytes make no sense), body is the
+ * code being timed. bench_run() times every call of body separately with the TSC.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef BENCH_H
+#define BENCH_H
+
+struct benchCase {
+    const char *name;
+    size_t (*setup)(void);
+    void (*body)(void);
+};
+
+#define BENCH(bench_name, bench_setup, bench_body) \
+    __attribute__((used, section(".bench"), aligned(8))) \
+    static struct benchCase bench_case_##bench_name = { #bench_name, bench_setup, bench_body }
+
+// Runs the benchmark called name, or all of them when name is NULL. False if nothing matched.
+bool bench_run(const char *name);
+void bench_list();
+
+#endif
@@ -0,0 +1,147 @@
+/* The benchmarks run by the shell's bench command. Register new ones with BENCH() anywhere in the kernel,
+ * these are the hot paths everything else sits on.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/bench.h>
+#include <kernel/mem.h>
+#include <kernel/slab.h>
+#include <kernel/paging.h>
+#include <kernel/vmalloc.h>
+#include <kernel/address_space.h>
+#include <kernel/vma.h>
+#include <kernel/printk.h>
+#include <drivers/disk.h>
+
+#define BENCH_BUFFER_SIZE 65536
+
+static uint8_t benchSrc[BENCH_BUFFER_SIZE];
+static uint8_t benchDst[BENCH_BUFFER_SIZE];
+
+// memcpy/memset at a few sizes, from well inside the rep movsb threshold to larger than L1
+#define BENCH_MEM(size) \
+    static size_t bench_mem_setup_##size(void) { return size; } \
+    static void bench_memcpy_body_##size(void) { memcpy(benchDst, benchSrc, size); } \
+    static void bench_memset_body_##size(void) { memset(benchDst, 0x5A, size); } \
+    BENCH(memcpy_##size, bench_mem_setup_##size, bench_memcpy_body_##size); \
+    BENCH(memset_##size, bench_mem_setup_##size, bench_memset_body_##size)
+
+BENCH_MEM(64);
+BENCH_MEM(512);
+BENCH_MEM(4096);
+BENCH_MEM(65536);
+
+static void bench_kmalloc_body(void) {
+    kfree(kmalloc(64));
+}
+BENCH(kmalloc_kfree_64, NULL, bench_kmalloc_body);
+
+// one page of vmalloc space, unmapped and mapped again by every iteration
+static uint64_t benchPageVirt = 0;
+static uint64_t benchPagePhys = 0;
+
+static size_t bench_map_page_setup(void) {
+    if (!benchPageVirt) {
+        benchPageVirt = (uint64_t)vmalloc(PAGE_SIZE);
+        benchPagePhys = benchPageVirt ? virt_to_phys(benchPageVirt) : 0;
+    }
+    return 0;
+}
+
+static void bench_map_page_body(void) {
+    if (!benchPageVirt)
+        return;
+    unmap_page(benchPageVirt);
+    map_page(benchPageVirt, benchPagePhys, PAGE_PRESENT | PAGE_RW);
+}
+BENCH(map_page, bench_map_page_setup, bench_map_page_body);
+
+// 64 pages, unmapped and mapped again with the batched calls
+#define BENCH_MAP_PAGES 64
+static uint64_t benchRangeVirt = 0;
+static uint64_t benchRangeFrames[BENCH_MAP_PAGES];
+
+static size_t bench_map_pages_setup(void) {
+    if (!benchRangeVirt) {
+        benchRangeVirt = (uint64_t)vmalloc(BENCH_MAP_PAGES * PAGE_SIZE);
+        for (int i = 0; benchRangeVirt && i < BENCH_MAP_PAGES; i++)
+            benchRangeFrames[i] = virt_to_phys(benchRangeVirt + i * PAGE_SIZE);
+    }
+    return 0;
+}
+
+static void bench_map_pages_body(void) {
+    if (!benchRangeVirt)
+        return;
+    unmap_pages(benchRangeVirt, BENCH_MAP_PAGES);
+    map_page_list(benchRangeVirt, benchRangeFrames, BENCH_MAP_PAGES, PAGE_PRESENT | PAGE_RW);
+}
+BENCH(map_pages_64, bench_map_pages_setup, bench_map_pages_body);
+
+// Cloning a one page program and tearing the clone down again. setup also checks that the copies come apart:
+// a write through either one after the clone must only be seen by that one.
+#define BENCH_CLONE_VIRT 0x400000ULL
+static struct addressSpace *benchCloneSource = NULL;
+
+static size_t bench_clone_setup(void) {
+    if (!benchCloneSource) {
+        benchCloneSource = address_space_create();
+        if (benchCloneSource && !vma_reserve(benchCloneSource, BENCH_CLONE_VIRT, PAGE_SIZE,
+                                             PAGE_PRESENT | PAGE_RW | PAGE_USER, NULL, NULL)) {
+            address_space_destroy(benchCloneSource);
+            benchCloneSource = NULL;
+        }
+        if (!benchCloneSource) {
+            printk("bench: no address space to clone\n");
+            return 0;
+        }
+    }
+    struct addressSpace *previous = address_space_current();
+    volatile uint8_t *page = (volatile uint8_t*)BENCH_CLONE_VIRT;
+    address_space_switch(benchCloneSource);
+    page[0] = 1; // faults the page in
+    struct addressSpace *clone = address_space_clone(benchCloneSource);
+    bool diverged = false;
+    if (clone) {
+        page[0] = 2;
+        address_space_switch(clone);
+        uint8_t inherited = page[0];
+        page[0] = 3;
+        uint8_t cloneSees = page[0];
+        address_space_switch(benchCloneSource);
+        diverged = inherited == 1 && cloneSees == 3 && page[0] == 2 &&
+                   address_space_translate(clone, BENCH_CLONE_VIRT) !=
+                   address_space_translate(benchCloneSource, BENCH_CLONE_VIRT);
+    }
+    address_space_switch(previous);
+    address_space_destroy(clone);
+    printk("bench: address_space_clone %s\n", diverged ? "copies diverge after writes" : "FAILED to diverge");
+    return 0;
+}
+
+static void bench_clone_body(void) {
+    if (benchCloneSource)
+        address_space_destroy(address_space_clone(benchCloneSource));
+}
+BENCH(address_space_clone, bench_clone_setup, bench_clone_body);
+
+static size_t bench_readdisk_setup(void) {
+    return 512;
+}
+
+static void bench_readdisk_body(void) {
+    readdisk(0);
+}
+BENCH(readdisk, bench_readdisk_setup, bench_readdisk_body);
+
+static const char benchLine[] = "bench: printk throughput, one line per iteration\n";
+
+static size_t bench_printk_setup(void) {
+    return sizeof(benchLine) - 1;
+}
+
+static void bench_printk_body(void) {
+    printk(benchLine);
+}
+BENCH(printk, bench_printk_setup, bench_printk_body);
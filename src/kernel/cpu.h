@@ -0,0 +1,29 @@
+/* Small per CPU helpers for the kernel.
+ * Only the bootstrap processor runs kernel code for now, so this_cpu() is always 0. Code that keeps per CPU
+ * state indexes it with this_cpu() and sizes it with MAX_CPUS so bringing up the APs only has to change this file.
+ */
+
+#include <stdint.h>
+
+#ifndef CPU_H
+#define CPU_H
+
+#define MAX_CPUS 16
+
+static inline uint32_t this_cpu(void) {
+    return 0;
+}
+
+// Disables interrupts and returns the previous RFLAGS, for irq_restore().
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    asm volatile("pushfq\n\tpopq %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Puts the interrupt flag back the way irq_save() found it.
+static inline void irq_restore(uint64_t flags) {
+    asm volatile("pushq %0\n\tpopfq" : : "r"(flags) : "memory", "cc");
+}
+
+#endif
@@ -0,0 +1,63 @@
+/* Physically contiguous buffers for device DMA.
+ * Buffers are single buddy blocks, so they are contiguous and aligned to their own size for free. The zone is
+ * picked from the highest address the device can reach, and the memory is zeroed so descriptor rings and
+ * frame lists start out in a known state.
+ */
+
+#include <stdint.h>
+#include <kernel/kernel.h>
+#include <kernel/printk.h>
+#include <kernel/mem.h>
+#include <kernel/simd.h>
+#include <kernel/pmm.h>
+#include <kernel/dma.h>
+
+#define DMA_FRAME_SIZE 4096
+
+// the highest zone that lies entirely at or below max_phys
+static uint8_t zone_for_limit(uint64_t max_phys) {
+    if (max_phys == UINT64_MAX)
+        return ZONE_NORMAL;
+    if (max_phys >= 0xFFFFFFFF)
+        return ZONE_DMA32;
+    return ZONE_DMA;
+}
+
+// Allocates at least size bytes starting at a multiple of align (a power of two), with every byte at or
+// below max_phys. On failure the returned buffer has phys == 0.
+struct dmaBuffer dma_alloc(uint64_t size, uint64_t align, uint64_t max_phys) {
+    struct dmaBuffer buffer = {0};
+    uint64_t need = size > align ? size : align;
+    uint8_t order = 0;
+    while (((uint64_t)DMA_FRAME_SIZE << order) < need)
+        order++;
+    if (size == 0 || order >= PMM_MAX_ORDER) {
+        printk("[DMA] dma_alloc: can't hand out %p bytes aligned to %p\n", (void*)size, (void*)align);
+        return buffer;
+    }
+
+    uint64_t phys = alloc_pages_zone(order, zone_for_limit(max_phys));
+    if (!phys)
+        return buffer;
+    // devices limited to less than 16 MiB still come from the DMA zone, but not every block in it will do
+    if (phys + ((uint64_t)DMA_FRAME_SIZE << order) - 1 > max_phys) {
+        printk("[DMA] dma_alloc: no memory below %p\n", (void*)max_phys);
+        free_pages(phys, order);
+        return buffer;
+    }
+
+    buffer.phys = phys;
+    buffer.virt = (void*)(phys + kernel.hhdm);
+    buffer.size = (uint64_t)DMA_FRAME_SIZE << order;
+    buffer.order = order;
+    simd_memset(buffer.virt, 0, buffer.size);
+    return buffer;
+}
+
+void dma_free(struct dmaBuffer *buffer) {
+    if (!buffer->phys)
+        return;
+    free_pages(buffer->phys, buffer->order);
+    buffer->phys = 0;
+    buffer->virt = NULL;
+}
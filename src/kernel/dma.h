@@ -0,0 +1,19 @@
+/* Header for ../dma.c, buffers that devices can bus master into.
+ */
+
+#include <stdint.h>
+
+#ifndef DMA_H
+#define DMA_H
+
+struct dmaBuffer {
+    uint64_t phys; // what the device gets told, 0 if the allocation failed
+    void *virt;    // the same memory through the HHDM, for the CPU
+    uint64_t size; // rounded up to whole frames
+    uint8_t order;
+};
+
+struct dmaBuffer dma_alloc(uint64_t size, uint64_t align, uint64_t max_phys);
+void dma_free(struct dmaBuffer *buffer);
+
+#endif
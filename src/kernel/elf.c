@@ -8,8 +8,16 @@
 #include <kernel/pmm.h>
 #include <stdlib/string.h>
 #include <kernel/mem.h>
+#include <kernel/simd.h>
+#include <kernel/paging.h>
+#include <kernel/address_space.h>
+#include <kernel/vma.h>
 #include <stddef.h>
 
+#define SHT_PROGBITS 0x01
+#define SHT_NOBITS   0x08
+#define SHF_ALLOC    0x02
+
 
 bool is_valid_elf(const uint8_t *magic) {
     // Use memcmp for binary comparison, not strcmp
@@ -122,6 +130,7 @@ int parse_section_header(uint8_t* elf, struct ELF_SECTION_HEADER_T* section_head
     uint64_t base_offset = offset + (index * header_size);
     section_header->name_offset = combine32bit(elf[base_offset+0x03],elf[base_offset+0x02],elf[base_offset+0x01],elf[base_offset + 0x00]);
     section_header->type = combine32bit(elf[base_offset+0x07],elf[base_offset+0x06],elf[base_offset+0x05],elf[base_offset + 0x04]);
+    section_header->flags = combine64bit(elf[base_offset+0x0F],elf[base_offset+0x0E],elf[base_offset+0x0D],elf[base_offset+0x0C],elf[base_offset+0x0B],elf[base_offset+0x0A],elf[base_offset+0x09],elf[base_offset+0x08]);
     // Parse virtual address (sh_addr)
     section_header->virtual_address = combine64bit(elf[base_offset+0x17],elf[base_offset+0x16],elf[base_offset+0x15],elf[base_offset+0x14],elf[base_offset+0x13],elf[base_offset+0x12],elf[base_offset+0x11],elf[base_offset+0x10]);
     section_header->offset = combine64bit(elf[base_offset+0x1F],elf[base_offset+0x1E],elf[base_offset+0x1D],elf[base_offset+0x1C],elf[base_offset+0x1B],elf[base_offset+0x1A],elf[base_offset+0x19],elf[base_offset+0x18]);
@@ -132,44 +141,134 @@ int parse_section_header(uint8_t* elf, struct ELF_SECTION_HEADER_T* section_head
 
 
 
-int read_elf(const uint8_t* elf, bool run) {
-    struct ELF_FILE_HEADER_T elf_header;
-    if (!parse_elf_header(elf, &elf_header)) {
+// Checks the header and that the whole section table lies inside the file. Returns 0 if it does.
+static int check_elf(const uint8_t* elf, uint64_t size, struct ELF_FILE_HEADER_T* elf_header) {
+    // the ELF64 header is 0x40 bytes
+    if (size < 0x40 || !parse_elf_header(elf, elf_header)) {
         kdebug("Failed to parse ELF header\n");
         return -1;
     }
+    // parse_section_header() reads 0x28 bytes of every entry, all of them have to be inside the file
+    uint64_t section_table_size = (uint64_t)elf_header->section_header_entry_count * elf_header->section_header_entry_size;
+    if (elf_header->section_header_entry_count &&
+        (elf_header->section_header_entry_size < 0x28 || elf_header->section_header_offset > size ||
+         section_table_size > size - elf_header->section_header_offset)) {
+        kdebug("Section header table out of file bounds\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Sections that end up in memory: allocated, with their contents in the file (or none, for .bss), and inside
+// the user half.
+static bool loadable_section(const struct ELF_SECTION_HEADER_T* sh, uint64_t size) {
+    if ((sh->type != SHT_PROGBITS && sh->type != SHT_NOBITS) || !(sh->flags & SHF_ALLOC) || sh->size == 0)
+        return false;
+    if (sh->type == SHT_PROGBITS && (sh->offset > size || sh->size > size - sh->offset)) {
+        kdebug("Section offset+size out of buffer bounds, skipping\n");
+        return false;
+    }
+    if (sh->virtual_address >= USER_SPACE_END || sh->size > USER_SPACE_END - sh->virtual_address) {
+        kdebug("Section outside the user half, skipping\n");
+        return false;
+    }
+    return true;
+}
+
+// Reserves every loadable section of elf in space, to be filled in page by page as the program touches it.
+// What the sections hold is copied into a vmaImage first, so elf can be freed once this returns.
+// Returns 0 and sets *entry on success.
+int load_elf(struct addressSpace *space, const uint8_t* elf, uint64_t size, uint64_t *entry) {
+    struct ELF_FILE_HEADER_T elf_header;
+    if (check_elf(elf, size, &elf_header) != 0)
+        return -1;
     print_elf_header(elf_header);
 
-    // Map all SHT_PROGBITS sections at their virtual addresses using paging
-    extern void map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
-    extern void* kmalloc();
+    // the image holds the span of the file the SHT_PROGBITS sections come from, which is never more than
+    // the file, however many sections point into it
+    uint32_t segments = 0;
+    uint64_t data_start = size;
+    uint64_t data_end = 0;
     for (int i = 0; i < elf_header.section_header_entry_count; i++) {
         struct ELF_SECTION_HEADER_T sh;
         if (parse_section_header((uint8_t*)elf, &sh, elf_header.section_header_offset, i, elf_header.section_header_entry_size) != 0) continue;
-        if (sh.type == 0x01 && sh.size > 0) {
-            if (sh.offset + sh.size > 4608) {
-                kdebug("Section offset+size out of buffer bounds, skipping\n");
+        if (!loadable_section(&sh, size) || sh.type != SHT_PROGBITS)
+            continue;
+        segments++;
+        data_start = sh.offset < data_start ? sh.offset : data_start;
+        data_end = sh.offset + sh.size > data_end ? sh.offset + sh.size : data_end;
+    }
+    struct vmaImage *image = NULL;
+    if (segments) {
+        image = vma_image_create(segments, data_end - data_start);
+        if (!image) {
+            kdebug("No memory for the program image\n");
+            return -1;
+        }
+        simd_memcpy(image->data, elf + data_start, data_end - data_start);
+    }
+
+    // sections that share or touch pages are merged into one VMA, they're usually in address order
+    int result = 0;
+    uint32_t segment = 0;
+    uint64_t run_start = 0;
+    uint64_t run_end = 0;
+    for (int i = 0; i <= elf_header.section_header_entry_count; i++) {
+        uint64_t first = 0;
+        uint64_t last = 0;
+        if (i < elf_header.section_header_entry_count) {
+            struct ELF_SECTION_HEADER_T sh;
+            if (parse_section_header((uint8_t*)elf, &sh, elf_header.section_header_offset, i, elf_header.section_header_entry_size) != 0) continue;
+            if (!loadable_section(&sh, size))
                 continue;
+            if (sh.type == SHT_PROGBITS) {
+                image->segments[segment].virt_addr = sh.virtual_address;
+                image->segments[segment].size = sh.size;
+                image->segments[segment].offset = sh.offset - data_start;
+                segment++;
             }
-            // Allocate physical memory for the section
-            uint8_t* phys = (uint8_t*)kmalloc();
-            if (!phys) {
-                kdebug("Failed to allocate physical memory for section\n");
+            first = sh.virtual_address & ~0xFFFULL;
+            last = (sh.virtual_address + sh.size + 0xFFF) & ~0xFFFULL;
+            if (run_end && first <= run_end && last >= run_start) {
+                run_start = first < run_start ? first : run_start;
+                run_end = last > run_end ? last : run_end;
                 continue;
             }
-            // Map the section at its virtual address
-            map_page(sh.virtual_address, (uint64_t)phys, 0x7); // present|rw|user
-            // Copy section data
-            for (size_t j = 0; j < sh.size; j++) {
-                phys[j] = elf[sh.offset + j];
-            }
         }
+        // the run ends here: at a section that doesn't touch it, or after the last one
+        if (run_end && !vma_reserve(space, run_start, run_end - run_start, 0x7, vma_image_fill, image)) { // present|rw|user
+            kdebug("Sections overlap an earlier reservation\n");
+            result = -1;
+            break;
+        }
+        run_start = first;
+        run_end = last;
     }
+    // the VMAs hold their own references
+    vma_image_put(image);
+    if (result == 0)
+        *entry = elf_header.entry_point_address;
+    return result;
+}
+
+// Loads elf into an address space of its own, runs it there if run is set, and tears the space down again.
+int read_elf(const uint8_t* elf, uint64_t size, bool run) {
+    struct addressSpace *space = address_space_create();
+    if (!space) {
+        kdebug("Failed to create an address space\n");
+        return -1;
+    }
+    uint64_t entry = 0;
+    int result = load_elf(space, elf, size, &entry);
     // Jump to entry point
-    if (run) {
-        int (*elf_entry_point)(void) = (int(*)(void))(elf_header.entry_point_address + kernel.hhdm);
-        printk("Running ELF entry point at 0x%zx\n", (size_t)elf_header.entry_point_address);
+    if (result == 0 && run) {
+        struct addressSpace *previous = address_space_current();
+        address_space_switch(space);
+        int (*elf_entry_point)(void) = (int(*)(void))entry;
+        printk("Running ELF entry point at 0x%zx\n", (size_t)entry);
         elf_entry_point();
+        address_space_switch(previous);
     }
-    return 0;
+    address_space_destroy(space);
+    return result;
 }
@@ -43,6 +43,8 @@ struct ELF_SECTION_HEADER_T {
 
 
 //bool is_valid_elf(struct ELF_FILE_HEADER_T header);
-int read_elf(const uint8_t* elf, bool run);
+struct addressSpace;
+int load_elf(struct addressSpace *space, const uint8_t* elf, uint64_t size, uint64_t *entry);
+int read_elf(const uint8_t* elf, uint64_t size, bool run);
 
 #endif
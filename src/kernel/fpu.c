@@ -0,0 +1,124 @@
+/* FPU/SSE/AVX state for kernel code.
+ * fpu_init() turns on FXSR/SSE and, when the CPU has it, XSAVE with AVX state in XCR0. Whatever was in the
+ * registers (a program started from the shell may use them) is saved by kernel_fpu_begin() into a per CPU
+ * area and put back by kernel_fpu_end(). Sections nest, and every level saves what it interrupts: interrupts
+ * are off inside a section, but an exception such as a page fault can still open another one on top.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/printk.h>
+#include <kernel/cpu.h>
+#include <kernel/init.h>
+#include <kernel/fpu.h>
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE (1 << 18)
+
+#define CPUID_1_EDX_FXSR (1 << 24)
+#define CPUID_1_EDX_SSE2 (1 << 26)
+#define CPUID_1_ECX_XSAVE (1 << 26)
+#define CPUID_1_ECX_AVX (1 << 28)
+#define CPUID_7_EBX_AVX2 (1 << 5)
+
+#define XCR0_X87 (1 << 0)
+#define XCR0_SSE (1 << 1)
+#define XCR0_AVX (1 << 2)
+
+// x87 + SSE + AVX need 832 bytes of XSAVE area
+#define FPU_AREA_SIZE 1024
+// a section, an exception inside it and one more inside that is as deep as it gets
+#define FPU_MAX_DEPTH 4
+
+struct fpuContext {
+    uint8_t area[FPU_MAX_DEPTH][FPU_AREA_SIZE]; // one per level, XSAVE wants them 64 byte aligned
+    uint64_t flags[FPU_MAX_DEPTH]; // RFLAGS from each kernel_fpu_begin()
+    uint32_t depth;
+} __attribute__((aligned(64)));
+
+static struct fpuContext fpuContexts[MAX_CPUS];
+static bool hasSse2 = false;
+static bool hasAvx2 = false;
+static bool useXsave = false;
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+__init void fpu_init() {
+    uint32_t eax, ebx, ecx, edx, maxLeaf;
+    cpuid(0, 0, &maxLeaf, &ebx, &ecx, &edx);
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_1_EDX_FXSR) || !(edx & CPUID_1_EDX_SSE2)) {
+        printk("[argaldOS:kernel:COR:FPU] no FXSR/SSE2, vector kernels disabled\n");
+        return;
+    }
+    bool xsave = ecx & CPUID_1_ECX_XSAVE;
+    bool avx = ecx & CPUID_1_ECX_AVX;
+
+    uint64_t cr0, cr4;
+    asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~(uint64_t)(CR0_EM | CR0_TS)) | CR0_MP;
+    asm volatile ("mov %0, %%cr0" :: "r"(cr0) : "memory");
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (xsave)
+        cr4 |= CR4_OSXSAVE;
+    asm volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
+    asm volatile ("fninit");
+    hasSse2 = true;
+
+    if (xsave && avx) {
+        uint64_t xcr0 = XCR0_X87 | XCR0_SSE | XCR0_AVX;
+        asm volatile ("xsetbv" :: "c"(0), "a"((uint32_t)xcr0), "d"((uint32_t)(xcr0 >> 32)));
+        // size of the XSAVE area for the features now enabled in XCR0
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx <= FPU_AREA_SIZE) {
+            useXsave = true;
+            if (maxLeaf >= 7) {
+                cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+                hasAvx2 = ebx & CPUID_7_EBX_AVX2;
+            }
+        }
+    }
+    printk("[argaldOS:kernel:COR:FPU] SSE2 yes, AVX2 %s, state saved with %s\n", hasAvx2 ? "yes" : "no",
+           useXsave ? "XSAVE" : "FXSAVE");
+}
+
+bool fpu_has_sse2() {
+    return hasSse2;
+}
+
+bool fpu_has_avx2() {
+    return hasAvx2;
+}
+
+void kernel_fpu_begin() {
+    uint64_t flags = irq_save();
+    struct fpuContext *context = &fpuContexts[this_cpu()];
+    if (context->depth == FPU_MAX_DEPTH) {
+        printk("[argaldOS:kernel:COR:FPU] FATAL: kernel_fpu_begin() nested %d deep\n", FPU_MAX_DEPTH);
+        for (;;)
+            asm volatile ("cli; hlt");
+    }
+    uint32_t level = context->depth++;
+    context->flags[level] = flags;
+    if (useXsave)
+        asm volatile ("xsave64 %0" : "=m"(context->area[level]) : "a"(XCR0_X87 | XCR0_SSE | XCR0_AVX), "d"(0) : "memory");
+    else
+        asm volatile ("fxsave64 %0" : "=m"(context->area[level]) : : "memory");
+}
+
+void kernel_fpu_end() {
+    struct fpuContext *context = &fpuContexts[this_cpu()];
+    uint32_t level = --context->depth;
+    if (useXsave)
+        asm volatile ("xrstor64 %0" : : "m"(context->area[level]), "a"(XCR0_X87 | XCR0_SSE | XCR0_AVX), "d"(0) : "memory");
+    else
+        asm volatile ("fxrstor64 %0" : : "m"(context->area[level]) : "memory");
+    irq_restore(context->flags[level]);
+}
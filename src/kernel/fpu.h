@@ -0,0 +1,18 @@
+/* Header for ../fpu.c, letting kernel code borrow the SSE/AVX registers.
+ * The kernel is built without SSE, so vector code lives in its own translation units and may only run
+ * between kernel_fpu_begin() and kernel_fpu_end(). Interrupts are off in between, keep the section short.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef FPU_H
+#define FPU_H
+
+void fpu_init();
+bool fpu_has_sse2();
+bool fpu_has_avx2();
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+#endif
@@ -0,0 +1,32 @@
+/* Releases the .init.text and .init.data sections after boot.
+ */
+
+#include <stdint.h>
+#include <kernel/kernel.h>
+#include <kernel/printk.h>
+#include <kernel/pmm.h>
+#include <kernel/paging.h>
+#include <kernel/init.h>
+
+// from linker.ld, page aligned
+extern char __init_text_start[], __init_text_end[];
+extern char __init_data_start[], __init_data_end[];
+
+static uint64_t free_section(char *start, char *end) {
+    uint64_t virt = (uint64_t)start;
+    uint64_t length = (uint64_t)(end - start);
+    if (!length)
+        return 0;
+    // unmap first, a stray call into init code should fault rather than run whatever the frame holds next
+    for (uint64_t offset = 0; offset < length; offset += PAGE_SIZE)
+        unmap_page(virt + offset);
+    uint64_t phys = virt - kernel.kernelAddress.virtual_base + kernel.kernelAddress.physical_base;
+    pmm_reclaim(phys, length);
+    return length;
+}
+
+void free_init_memory(void) {
+    uint64_t freed = free_section(__init_text_start, __init_text_end);
+    freed += free_section(__init_data_start, __init_data_end);
+    printk("[argaldOS:kernel:COR] Freed %d KB of init memory\n", freed / 1024);
+}
@@ -0,0 +1,15 @@
+/* Boot only code and data.
+ * Functions marked __init and variables marked __initdata are linked into .init.text and .init.data, which
+ * free_init_memory() gives back to the PMM once kernel_start is done booting. Nothing that runs after that
+ * may call or reference them.
+ */
+
+#ifndef INIT_H
+#define INIT_H
+
+#define __init     __attribute__((section(".init.text")))
+#define __initdata __attribute__((section(".init.data")))
+
+void free_init_memory(void);
+
+#endif
@@ -8,12 +8,6 @@
 
 #define KERNEL_VERSION "v.0.0.1"
 
-struct largestSection {
-    int maxBegin;
-    int maxLength;
-    int bitmapReserved; // in bytes
-};
-
 struct idtr {
     uint16_t size;
     uint64_t offset;
@@ -40,7 +34,6 @@ struct TSS {
 typedef struct {
       uint64_t hhdm; // limine higher half direct mapping
       uint64_t memmapEntryCount;
-      struct largestSection largestSect; // info about location of the pmm's bitmap
       struct limine_memmap_entry **memmapEntries;
       struct limine_kernel_file_response kernelFile;
       struct limine_kernel_address_response kernelAddress;
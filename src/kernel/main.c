@@ -14,6 +14,10 @@
 #include <kernel/pmm.h>
 #include <kernel/timer.h>
 #include <kernel/mem.h>
+#include <kernel/fpu.h>
+#include <kernel/tlb.h>
+#include <kernel/address_space.h>
+#include <kernel/init.h>
 
 #include <kernel/paging.h>
 #include <fs/fat/fat32.h>
@@ -82,13 +86,29 @@ static void hcf(void) {
 
 Kernel kernel = {0};
 
-void init_kernel_data() {
+// The Limine responses live in bootloader reclaimable memory, which is freed once we've booted,
+// so everything the kernel keeps using is copied here first.
+#define MAX_MEMMAP_ENTRIES 128
+static struct limine_memmap_entry memmapCopy[MAX_MEMMAP_ENTRIES];
+static struct limine_memmap_entry *memmapPointers[MAX_MEMMAP_ENTRIES];
+static struct limine_file kernelFileCopy;
+
+__init void init_kernel_data() {
     // bootloader information
     kernel.hhdm = (hhdmRequest.response)->offset;
     struct limine_memmap_response memmapResponse = *memmapRequest.response;
-    kernel.memmapEntryCount = memmapResponse.entry_count;
-    kernel.memmapEntries = memmapResponse.entries;
+    kernel.memmapEntryCount = memmapResponse.entry_count < MAX_MEMMAP_ENTRIES ? memmapResponse.entry_count : MAX_MEMMAP_ENTRIES;
+    for (uint64_t i = 0; i < kernel.memmapEntryCount; i++) {
+        memmapCopy[i] = *memmapResponse.entries[i];
+        memmapPointers[i] = &memmapCopy[i];
+    }
+    kernel.memmapEntries = memmapPointers;
+    // the kernel file itself is in kernel and modules memory and stays, only its descriptor moves
+    kernelFileCopy = *kernelElfRequest.response->kernel_file;
+    kernelFileCopy.path = NULL;
+    kernelFileCopy.cmdline = NULL;
     kernel.kernelFile = *kernelElfRequest.response;
+    kernel.kernelFile.kernel_file = &kernelFileCopy;
     kernel.kernelAddress = *kernelAddressRequest.response;
     // other info
     kernel.schedulerTurn = 0;
@@ -102,7 +122,7 @@ void init_kernel_data() {
 }
 
 
-void print_banner() {
+__init void print_banner() {
    printk("\n");
    printk("                       _     _  ___  ____  \n");
    printk("  __ _ _ __ __ _  __ _| | __| |/ _ \\/ ___| \n");
@@ -137,9 +157,13 @@ void kernel_start(void) {
     init_kernel_data();
     init_serial();
     print_banner();
+    mem_init();
+    fpu_init();
     printk("[argaldOS:kernel:COR] argaldOS kernel is bootstrapping\n");
     initPMM();
     init_paging(); // Enable paging after PMM is ready
+    tlb_init();
+    address_space_init();
     initGDT();
     initIDT();
     setup_timer();
@@ -149,11 +173,27 @@ void kernel_start(void) {
     uhci_init(&kernel.usb_device);
     //fat32_init();
 
+    // the Limine data we need has been copied, and the stack we're on is the only bootloader memory still in use,
+    // as long as CR3 holds our own tables: Limine's are in the memory about to be freed
+    uint64_t rsp, cr3;
+    asm volatile ("mov %%rsp, %0" : "=r"(rsp));
+    asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+    if ((cr3 & 0x000FFFFFFFFFF000ULL) == paging_kernel_root())
+        pmm_reclaim_bootloader(rsp);
+    else
+        printk("[argaldOS:kernel:COR] Not reclaiming bootloader memory, CR3 %p isn't the kernel's page tables\n",
+               (void*)cr3);
+    free_init_memory();
+
 
     printk("\nargaldOS has completely booted up. The kernel is idle now.\n\n");
     printk("Press F1 should you want to open a pseudo-terminal running in kernel space\n\n");
 
-    while(1);
+    // idle: zero free frames ahead of time, and sleep until the next interrupt once there are enough
+    while(1) {
+        if (!pmm_zero_idle())
+            asm("hlt");
+    }
 
     // We should never get here :(
 
@@ -1,24 +1,106 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <kernel/init.h>
 
-void *memcpy(void *dest, const void *src, size_t n) {
-    uint8_t *pdest = (uint8_t *)dest;
-    const uint8_t *psrc = (const uint8_t *)src;
+// CPUID.(EAX=7,ECX=0) feature bits
+#define CPUID_EBX_ERMS (1 << 9) // Enhanced REP MOVSB/STOSB
+#define CPUID_EDX_FSRM (1 << 4) // Fast Short REP MOVSB
 
-    for (size_t i = 0; i < n; i++) {
-        pdest[i] = psrc[i];
+// Without FSRM, rep movsb has a startup cost that only pays off past this many bytes
+#define REP_MOVSB_THRESHOLD 128
+
+// 64 bit accesses into memory that may be of any type, at any alignment
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_word;
+
+// Stay false until mem_init(), everything works with the word loops before that.
+static bool hasErms = false;
+static bool hasFsrm = false;
+
+__init void mem_init() {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+    if (eax >= 7) {
+        asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+        hasErms = ebx & CPUID_EBX_ERMS;
+        hasFsrm = edx & CPUID_EDX_FSRM;
+    }
+    printk("[argaldOS:kernel:COR:MEM] rep movsb/stosb: ERMS %s, FSRM %s\n", hasErms ? "yes" : "no", hasFsrm ? "yes" : "no");
+}
+
+static inline bool use_rep(size_t n) {
+    return hasFsrm || (hasErms && n >= REP_MOVSB_THRESHOLD);
+}
+
+static inline void rep_movsb(void *dest, const void *src, size_t n) {
+    asm volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+static inline void rep_stosb(void *dest, uint8_t c, size_t n) {
+    asm volatile ("rep stosb" : "+D"(dest), "+c"(n) : "a"(c) : "memory");
+}
+
+// Copies forwards: bytes until dest is 8 byte aligned, then whole words, then the rest.
+static void copy_forward(uint8_t *pdest, const uint8_t *psrc, size_t n) {
+    while (n && ((uintptr_t)pdest & 7)) {
+        *pdest++ = *psrc++;
+        n--;
+    }
+    for (; n >= 8; n -= 8, pdest += 8, psrc += 8) {
+        *(unaligned_word *)pdest = *(const unaligned_word *)psrc;
+    }
+    while (n--) {
+        *pdest++ = *psrc++;
+    }
+}
+
+// Same from the end down, for memmove into a higher overlapping address.
+static void copy_backward(uint8_t *pdest, const uint8_t *psrc, size_t n) {
+    pdest += n;
+    psrc += n;
+    while (n && ((uintptr_t)pdest & 7)) {
+        *--pdest = *--psrc;
+        n--;
     }
+    for (; n >= 8; n -= 8) {
+        pdest -= 8;
+        psrc -= 8;
+        *(unaligned_word *)pdest = *(const unaligned_word *)psrc;
+    }
+    while (n--) {
+        *--pdest = *--psrc;
+    }
+}
 
+void *memcpy(void *dest, const void *src, size_t n) {
+    if (use_rep(n)) {
+        rep_movsb(dest, src, n);
+    } else {
+        copy_forward((uint8_t *)dest, (const uint8_t *)src, n);
+    }
     return dest;
 }
 
 void *memset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
-
-    for (size_t i = 0; i < n; i++) {
-        p[i] = (uint8_t)c;
+    if (use_rep(n)) {
+        rep_stosb(s, (uint8_t)c, n);
+        return s;
     }
 
+    uint8_t *p = (uint8_t *)s;
+    uint64_t word = 0x0101010101010101ULL * (uint8_t)c;
+    while (n && ((uintptr_t)p & 7)) {
+        *p++ = (uint8_t)c;
+        n--;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        *(unaligned_word *)p = word;
+    }
+    while (n--) {
+        *p++ = (uint8_t)c;
+    }
     return s;
 }
 
@@ -26,23 +108,55 @@ void *memmove(void *dest, const void *src, size_t n) {
     uint8_t *pdest = (uint8_t *)dest;
     const uint8_t *psrc = (const uint8_t *)src;
 
-    if (src > dest) {
-        for (size_t i = 0; i < n; i++) {
-            pdest[i] = psrc[i];
-        }
-    } else if (src < dest) {
-        for (size_t i = n; i > 0; i--) {
-            pdest[i-1] = psrc[i-1];
-        }
+    // a forward copy is only wrong when dest starts inside src
+    if (pdest <= psrc || pdest >= psrc + n) {
+        memcpy(dest, src, n);
+    } else {
+        // rep movsb with DF set has no fast microcode, the word loop is quicker
+        copy_backward(pdest, psrc, n);
     }
 
     return dest;
 }
 
+// Non-temporal memset: the aligned middle is written with movnti, which goes around the cache, for buffers
+// that won't be read again soon. simd_memset_nt() falls back to it without SSE2. The sfence orders the
+// streaming stores before anything written after the call.
+static inline void movnti(void *p, uint64_t word) {
+    asm volatile ("movnti %1, %0" : "=m"(*(uint64_t *)p) : "r"(word));
+}
+
+void *memset_nt(void *s, int c, size_t n) {
+    uint8_t *p = (uint8_t *)s;
+    uint64_t word = 0x0101010101010101ULL * (uint8_t)c;
+    while (n && ((uintptr_t)p & 7)) {
+        *p++ = (uint8_t)c;
+        n--;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        movnti(p, word);
+    }
+    while (n--) {
+        *p++ = (uint8_t)c;
+    }
+    asm volatile ("sfence" : : : "memory");
+    return s;
+}
+
 int memcmp(const void *s1, const void *s2, size_t n) {
     const uint8_t *p1 = (const uint8_t *)s1;
     const uint8_t *p2 = (const uint8_t *)s2;
 
+    // all n bytes are readable, so unaligned words are fine; byte swapping the first words that differ makes
+    // the lowest addressed byte the most significant, and a plain comparison gives the memcmp order
+    for (; n >= 8; n -= 8, p1 += 8, p2 += 8) {
+        uint64_t w1 = *(const unaligned_word *)p1;
+        uint64_t w2 = *(const unaligned_word *)p2;
+        if (w1 != w2) {
+            return __builtin_bswap64(w1) < __builtin_bswap64(w2) ? -1 : 1;
+        }
+    }
+
     for (size_t i = 0; i < n; i++) {
         if (p1[i] != p2[i]) {
             return p1[i] < p2[i] ? -1 : 1;
@@ -51,3 +165,24 @@ int memcmp(const void *s1, const void *s2, size_t n) {
 
     return 0;
 }
+
+void *memchr(const void *s, int c, size_t n) {
+    const uint8_t *p = (const uint8_t *)s;
+    uint64_t pattern = 0x0101010101010101ULL * (uint8_t)c;
+
+    // a word holds c iff word ^ pattern has a zero byte
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t word = *(const unaligned_word *)p ^ pattern;
+        if ((word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+
+    for (; n; n--, p++) {
+        if (*p == (uint8_t)c) {
+            return (void *)p;
+        }
+    }
+
+    return NULL;
+}
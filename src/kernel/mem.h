@@ -4,10 +4,13 @@
 #ifndef MEM_H
 #define MEM_H
 
-
+void mem_init();
 void *memcpy(void *dest, const void *src, size_t n);
 void *memset(void *s, int c, size_t n);
 void *memmove(void *dest, const void *src, size_t n);
 int memcmp(const void *s1, const void *s2, size_t n);
+void *memchr(const void *s, int c, size_t n);
+// bypass the cache, for data that won't be read back soon
+void *memset_nt(void *s, int c, size_t n);
 
 #endif
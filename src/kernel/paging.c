@@ -4,6 +4,11 @@
 #include <kernel/pmm.h>
 #include <string.h>
 #include <kernel/util/utils.h>
+#include <kernel/init.h>
+#include <kernel/tlb.h>
+#include <kernel/cpu.h>
+#include <kernel/simd.h>
+#include <kernel/vmalloc.h>
 
 // Track page tables we create for later mapping
 #define MAX_EARLY_PAGE_TABLES 256
@@ -13,87 +18,126 @@ static int num_early_page_tables = 0;
 // Function declarations
 static void add_early_page_table(uint64_t addr);
 static uint64_t* alloc_table(int do_map);
-static uint64_t* get_next_table(uint64_t* table, int index, int create);
+static uint64_t* get_next_table(uint64_t* table, int index, int level, int create);
 
-// Simple page table structures for x86_64
+// Simple page table structures for x86_64. pml4 is whatever CR3 holds, kernelPml4 the tables init_paging()
+// built, which every other address space takes its kernel half from.
 static uint64_t* pml4 = 0;
+static uint64_t* kernelPml4 = 0;
+
+// Kernel half mappings are shared by every address space, so they go in global
+static inline uint64_t global_for(uint64_t virt_addr, uint64_t flags) {
+    return virt_addr >= KERNEL_SPACE_START ? flags | PAGE_GLOBAL : flags;
+}
 
 // Allocate a new page-aligned page table
 static uint64_t* alloc_table(int do_map) {
-    printk("[paging] alloc_table: starting allocation\n");
-    uint64_t* table = (uint64_t*)kmalloc();
+    // comes from the pre-zeroed pool when the idle loop has had time to fill it
+    uint64_t* table = (uint64_t*)alloc_zeroed_page();
     if (!table) {
-        printk("[paging] alloc_table: kmalloc failed!\n");
+        printk("[paging] alloc_table: alloc_zeroed_page failed!\n");
         return NULL;
     }
-    printk("[paging] alloc_table: kmalloc returned %p (HHDM %p)\n", table, (void*)((uint64_t)table + kernel.hhdm));
-    printk("[paging] hhdm value: %p\n", (void*)kernel.hhdm);
-    printk("[paging] attempting HHDM write test...\n");
-    volatile uint64_t *test = (uint64_t*)((uint64_t)table + kernel.hhdm);
-    printk("[paging] HHDM pointer created: %p\n", test);
-    *test = 0xdeadbeef;
-    printk("[paging] wrote 0xdeadbeef to hhdm-mapped page table\n");
-    // Zero the table through HHDM one word at a time
-    printk("[paging] alloc_table: zeroing table through HHDM at %p\n", test);
-    volatile uint64_t* ptr = test;
-    for (int i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
-        ptr[i] = 0;
-    }
-    printk("[paging] alloc_table: finished zeroing table\n");
+    kdebug("[paging] alloc_table: alloc_zeroed_page returned %p (HHDM %p)\n", table, (void*)((uint64_t)table + kernel.hhdm));
 
     // We no longer try to map tables here to avoid recursion
     return table;
 }
 
-static void map_range(volatile uint64_t* hhdm_pml4_ptr, uint64_t virt_start, uint64_t virt_end, uint64_t flags) {
-    for (uint64_t vaddr = virt_start & ~0xFFFULL; vaddr < virt_end; vaddr += 0x1000) {
-        // For identity mapping, physical address is the same as virtual for low addresses
-        uint64_t paddr = vaddr >= kernel.hhdm ? (vaddr - kernel.hhdm) : vaddr;
-        
-        int pml4_idx = (vaddr >> 39) & 0x1FF;
-        int pdpt_idx = (vaddr >> 30) & 0x1FF;
-        int pd_idx = (vaddr >> 21) & 0x1FF;
-        int pt_idx = (vaddr >> 12) & 0x1FF;
-
-        //printk("[paging] Mapping v=%p to p=%p (indices: %d,%d,%d,%d)\n", 
-        //       (void*)vaddr, (void*)paddr, pml4_idx, pdpt_idx, pd_idx, pt_idx);
-
-        volatile uint64_t* pdpt;
-        if (!(hhdm_pml4_ptr[pml4_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pdpt = alloc_table(0);
-            // Store physical address in page table
-            hhdm_pml4_ptr[pml4_idx] = ((uint64_t)new_pdpt) | PAGE_PRESENT | PAGE_RW;
-            printk("[paging] New PDPT at p=%p\n", new_pdpt);
+// init_paging() and its helpers are the only users of these two, so they're freed with .init.data
+// Set from CPUID.80000001h:EDX.Page1GB, PDPT entries can only have PS set when it is
+__initdata static bool hasGigPages = false;
+// Leaf entries written by map_range, indexed by level (1 = 1 GiB, 2 = 2 MiB, 3 = 4 KiB)
+__initdata static uint64_t mappedPages[4];
+
+__init static void detect_page_sizes(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000000), "c"(0));
+    if (eax >= 0x80000001) {
+        asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001), "c"(0));
+        hasGigPages = edx & (1u << 26);
+    }
+    printk("[paging] 1GB pages %s\n", hasGigPages ? "supported" : "not supported");
+}
+
+// Maps [virt_start, virt_end) to the physical range starting at phys_start. Each step uses the largest page, up
+// to max_page, that both addresses are aligned to and that still fits in what is left of the range. Whatever is
+// already mapped is left alone.
+__init static void map_range(volatile uint64_t* hhdm_pml4_ptr, uint64_t virt_start, uint64_t virt_end,
+                             uint64_t phys_start, uint64_t flags, uint64_t max_page) {
+    uint64_t vaddr = virt_start & ~0xFFFULL;
+    uint64_t paddr = phys_start & ~0xFFFULL;
+    while (vaddr < virt_end) {
+        volatile uint64_t* table = hhdm_pml4_ptr;
+        uint64_t size = 0;
+        for (int level = 0; level < 4; level++) {
+            int shift = 39 - 9 * level;
+            volatile uint64_t* entry = &table[(vaddr >> shift) & 0x1FF];
+            size = 1ULL << shift;
+
+            bool leaf = level == 3 || level == 2 || (level == 1 && hasGigPages);
+            if (leaf && size <= max_page && !((vaddr | paddr) & (size - 1)) && virt_end - vaddr >= size
+                && !(*entry & PAGE_PRESENT)) {
+                // PS is the PAT bit in a PT entry, it only means "huge" above that
+                *entry = paddr | flags | PAGE_PRESENT | (level < 3 ? PAGE_HUGE : 0);
+                mappedPages[level]++;
+                break;
+            }
+            if (level == 3 || (*entry & (PAGE_PRESENT | PAGE_HUGE)) == (PAGE_PRESENT | PAGE_HUGE)) {
+                // mapped by an earlier call, skip to the end of that page
+                size -= vaddr & (size - 1);
+                break;
+            }
+            if (!(*entry & PAGE_PRESENT)) {
+                uint64_t* next = alloc_table(0);
+                if (!next) {
+                    printk("[paging] map_range: FATAL - out of memory for page tables at %p\n", (void*)vaddr);
+                    return;
+                }
+                add_early_page_table((uint64_t)next);
+                *entry = ((uint64_t)next) | PAGE_PRESENT | PAGE_RW;
+            }
+            table = (uint64_t*)((*entry & 0x000FFFFFFFFFF000ULL) + kernel.hhdm);
         }
-        pdpt = (uint64_t*)((hhdm_pml4_ptr[pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-
-        volatile uint64_t* pd;
-        if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pd = alloc_table(0);
-            // Store physical address in page table
-            pdpt[pdpt_idx] = ((uint64_t)new_pd) | PAGE_PRESENT | PAGE_RW;
-            printk("[paging] New PD at p=%p\n", new_pd);
+        vaddr += size;
+        paddr += size;
+        if (!vaddr) // wrapped past the top of the address space
+            break;
+    }
+}
+
+// Everything the kernel reaches through the HHDM: RAM, the kernel image, ACPI tables and the framebuffer.
+// Adjacent entries are merged first so a run split across types can still use the big pages.
+__init static void map_hhdm(volatile uint64_t* hhdm_pml4_ptr) {
+    uint64_t runStart = 0, runEnd = 0;
+    for (uint64_t i = 0; i <= kernel.memmapEntryCount; i++) {
+        struct limine_memmap_entry *entry = i < kernel.memmapEntryCount ? kernel.memmapEntries[i] : NULL;
+        // reserved ranges can be MMIO, which must not end up cached through a write-back mapping
+        if (entry && entry->type != LIMINE_MEMMAP_RESERVED && entry->type != LIMINE_MEMMAP_BAD_MEMORY) {
+            if (runEnd == entry->base && runEnd != runStart) {
+                runEnd += entry->length;
+                continue;
+            }
         }
-        pd = (uint64_t*)((pdpt[pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-
-        volatile uint64_t* pt;
-        if (!(pd[pd_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pt = alloc_table(0);
-            // Store physical address in page table
-            pd[pd_idx] = ((uint64_t)new_pt) | PAGE_PRESENT | PAGE_RW;
-            printk("[paging] New PT at p=%p\n", new_pt);
+        if (runEnd != runStart) {
+            map_range(hhdm_pml4_ptr, kernel.hhdm + runStart, kernel.hhdm + runEnd, runStart,
+                      PAGE_RW | PAGE_GLOBAL, ~0ULL);
+        }
+        runStart = runEnd = 0;
+        if (entry && entry->type != LIMINE_MEMMAP_RESERVED && entry->type != LIMINE_MEMMAP_BAD_MEMORY) {
+            runStart = entry->base;
+            runEnd = entry->base + entry->length;
         }
-        pt = (uint64_t*)((pd[pd_idx] & ~0xFFFULL) + kernel.hhdm);
-
-        // Store physical address in page table
-        pt[pt_idx] = paddr | flags | PAGE_PRESENT;
-        //printk("[paging] PT[%d] = %p\n", pt_idx, (void*)(paddr | flags | PAGE_PRESENT));
     }
 }
 
-void init_paging() {
+// from linker.ld
+extern char __kernel_end[];
+
+__init void init_paging() {
     printk("[paging] init_paging: start (HHDM offset: %p)\n", (void*)kernel.hhdm);
-    
+    detect_page_sizes();
+
     // Reset early page table tracking
     num_early_page_tables = 0;
     
@@ -108,287 +152,59 @@ void init_paging() {
     volatile uint64_t* hhdm_pml4_ptr = (uint64_t*)((uint64_t)pml4 + kernel.hhdm);
     printk("[paging] init_paging: pml4 allocated at phys=%p (HHDM=%p)\n", pml4, (void*)hhdm_pml4_ptr);
 
-    // 1. Identity map first 2MB (crucial bootloader and kernel areas)
+    // 1. Identity map first 2MB (crucial bootloader and kernel areas). The fixed range MTRRs give the first MB
+    // several memory types, so it stays in 4KB pages rather than one large page spanning them.
     printk("[paging] Mapping first 2MB identity...\n");
-    map_range(hhdm_pml4_ptr, 0, 0x200000, PAGE_PRESENT | PAGE_RW);
+    map_range(hhdm_pml4_ptr, 0, 0x200000, 0, PAGE_RW, PAGE_SIZE);
 
-    // 2. Get and map the current code region
-    uint64_t code_start = (uint64_t)&init_paging & ~0xFFFULL;
-    printk("[paging] Mapping code region at %p\n", (void*)code_start);
-    map_range(hhdm_pml4_ptr, code_start & ~0x1FFFFF, (code_start + 0x200000) & ~0xFFF, PAGE_PRESENT | PAGE_RW);
+    // 2. The HHDM, which also covers the stack we're on and every page table allocated here
+    printk("[paging] Mapping HHDM regions...\n");
+    map_hhdm(hhdm_pml4_ptr);
 
-    // 3. Get and map the current stack region
-    uint64_t current_rsp;
-    asm volatile ("mov %%rsp, %0" : "=r"(current_rsp));
-    uint64_t stack_start = current_rsp & ~0x1FFFFF; // Round down to 2MB
-    printk("[paging] Mapping stack region at %p\n", (void*)stack_start);
-    map_range(hhdm_pml4_ptr, stack_start, stack_start + 0x200000, PAGE_PRESENT | PAGE_RW);
+    // 3. The kernel image, where it was linked rather than where it was loaded
+    uint64_t kernel_virt = kernel.kernelAddress.virtual_base;
+    uint64_t kernel_phys = kernel.kernelAddress.physical_base;
+    uint64_t kernel_end = ((uint64_t)__kernel_end + 0xFFF) & ~0xFFFULL;
+    printk("[paging] Mapping kernel image %p-%p at phys=%p\n", (void*)kernel_virt, (void*)kernel_end, (void*)kernel_phys);
+    map_range(hhdm_pml4_ptr, kernel_virt, kernel_end, kernel_phys, PAGE_RW | PAGE_GLOBAL, ~0ULL);
 
-    // 4. Map the same regions in HHDM
-    printk("[paging] Mapping HHDM regions...\n");
-    map_range(hhdm_pml4_ptr, kernel.hhdm, kernel.hhdm + 0x200000, PAGE_PRESENT | PAGE_RW); // First 2MB
-    map_range(hhdm_pml4_ptr, kernel.hhdm + (code_start & ~0x1FFFFF), 
-             kernel.hhdm + ((code_start + 0x200000) & ~0xFFF), PAGE_PRESENT | PAGE_RW);
-    map_range(hhdm_pml4_ptr, kernel.hhdm + stack_start, 
-             kernel.hhdm + stack_start + 0x200000, PAGE_PRESENT | PAGE_RW);
-    
-    // First set up essential kernel mappings
-    printk("[paging] Setting up essential mappings...\n");
-    
-    // Identity map current code page (containing init_paging function)
-    uint64_t code_page = ((uint64_t)&init_paging) & ~0xFFFULL;
-    
-    // First map one page directly through page table manipulation
-    int pml4_idx = (code_page >> 39) & 0x1FF;
-    int pdpt_idx = (code_page >> 30) & 0x1FF;
-    int pd_idx = (code_page >> 21) & 0x1FF;
-    int pt_idx = (code_page >> 12) & 0x1FF;
-    
-    printk("[paging] Mapping code page at %p\n", (void*)code_page);
-    
-    // Create page tables manually
-    volatile uint64_t* hhdm_pml4 = (uint64_t*)((uint64_t)pml4 + kernel.hhdm);
-    
-    // Allocate PDPT if needed
-    if (!(hhdm_pml4[pml4_idx] & PAGE_PRESENT)) {
+    // 4. A PDPT behind the vmalloc window's PML4 entries, the only kernel half mappings made after boot, so
+    // every address space shares them (see paging_new_root). The HHDM and kernel image have theirs already.
+    for (int i = (VMALLOC_START >> 39) & 0x1FF; i <= (int)(((VMALLOC_END - 1) >> 39) & 0x1FF); i++) {
+        if (hhdm_pml4_ptr[i] & PAGE_PRESENT)
+            continue;
         uint64_t* pdpt = alloc_table(0);
-        hhdm_pml4[pml4_idx] = ((uint64_t)pdpt) | PAGE_PRESENT | PAGE_RW;
-    }
-    volatile uint64_t* pdpt = (uint64_t*)((hhdm_pml4[pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-    
-    // Allocate PD if needed
-    if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-        uint64_t* pd = alloc_table(0);
-        pdpt[pdpt_idx] = ((uint64_t)pd) | PAGE_PRESENT | PAGE_RW;
-    }
-    volatile uint64_t* pd = (uint64_t*)((pdpt[pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-    
-    // Allocate PT if needed
-    if (!(pd[pd_idx] & PAGE_PRESENT)) {
-        uint64_t* pt = alloc_table(0);
-        pd[pd_idx] = ((uint64_t)pt) | PAGE_PRESENT | PAGE_RW;
-    }
-    volatile uint64_t* pt = (uint64_t*)((pd[pd_idx] & ~0xFFFULL) + kernel.hhdm);
-    
-    // Map the page - code_page is both virtual and physical for identity mapping
-    uint64_t phys_code_page = code_page; // In identity mapping, they're the same
-    pt[pt_idx] = phys_code_page | PAGE_PRESENT | PAGE_RW;
-    
-    printk("[paging] Mapped initial code page successfully (phys=%p)\n", (void*)phys_code_page);
-    
-    // Now map HHDM region for the code page
-    uint64_t hhdm_addr = code_page + kernel.hhdm;
-    pml4_idx = (hhdm_addr >> 39) & 0x1FF;
-    pdpt_idx = (hhdm_addr >> 30) & 0x1FF;
-    pd_idx = (hhdm_addr >> 21) & 0x1FF;
-    pt_idx = (hhdm_addr >> 12) & 0x1FF;
-    
-    // Repeat the same process for HHDM mapping
-    if (!(hhdm_pml4[pml4_idx] & PAGE_PRESENT)) {
-        uint64_t* pdpt = alloc_table(0);
-        hhdm_pml4[pml4_idx] = ((uint64_t)pdpt) | PAGE_PRESENT | PAGE_RW;
-    }
-    pdpt = (uint64_t*)((hhdm_pml4[pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-    
-    if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-        uint64_t* pd = alloc_table(0);
-        pdpt[pdpt_idx] = ((uint64_t)pd) | PAGE_PRESENT | PAGE_RW;
-    }
-    pd = (uint64_t*)((pdpt[pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-    
-    if (!(pd[pd_idx] & PAGE_PRESENT)) {
-        uint64_t* pt = alloc_table(0);
-        pd[pd_idx] = ((uint64_t)pt) | PAGE_PRESENT | PAGE_RW;
-    }
-    pt = (uint64_t*)((pd[pd_idx] & ~0xFFFULL) + kernel.hhdm);
-    
-    // Map the HHDM page
-    pt[pt_idx] = (code_page) | PAGE_PRESENT | PAGE_RW;
-    
-    printk("[paging] Mapped HHDM code page successfully\n");
-
-    // Get current stack pointer to ensure stack is mapped
-    uint64_t stack_ptr;
-    asm volatile ("mov %%rsp, %0" : "=r"(stack_ptr));
-    uint64_t stack_page = stack_ptr & ~0xFFFULL;
-    
-    // Map a few pages around the stack pointer to ensure we have enough stack space
-    for (uint64_t addr = stack_page - 0x4000; addr <= stack_page + 0x4000; addr += 0x1000) {
-        printk("[paging] Mapping stack page at %p\n", (void*)addr);
-        
-        // Map both identity and HHDM for stack
-        // Identity mapping
-        pml4_idx = (addr >> 39) & 0x1FF;
-        pdpt_idx = (addr >> 30) & 0x1FF;
-        pd_idx = (addr >> 21) & 0x1FF;
-        pt_idx = (addr >> 12) & 0x1FF;
-        
-        if (!(hhdm_pml4[pml4_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pdpt = alloc_table(0);
-            hhdm_pml4[pml4_idx] = ((uint64_t)new_pdpt) | PAGE_PRESENT | PAGE_RW;
-        }
-        pdpt = (uint64_t*)((hhdm_pml4[pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pd = alloc_table(0);
-            pdpt[pdpt_idx] = ((uint64_t)new_pd) | PAGE_PRESENT | PAGE_RW;
-        }
-        pd = (uint64_t*)((pdpt[pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pd[pd_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pt = alloc_table(0);
-            pd[pd_idx] = ((uint64_t)new_pt) | PAGE_PRESENT | PAGE_RW;
-        }
-        pt = (uint64_t*)((pd[pd_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        // For identity mapping, addr is both virtual and physical
-        uint64_t phys_stack_addr = addr;
-        pt[pt_idx] = phys_stack_addr | PAGE_PRESENT | PAGE_RW;
-        printk("[paging] Mapped identity stack page phys=%p\n", (void*)phys_stack_addr);
-        
-        // HHDM mapping for stack
-        uint64_t hhdm_addr = addr + kernel.hhdm;
-        pml4_idx = (hhdm_addr >> 39) & 0x1FF;
-        pdpt_idx = (hhdm_addr >> 30) & 0x1FF;
-        pd_idx = (hhdm_addr >> 21) & 0x1FF;
-        pt_idx = (hhdm_addr >> 12) & 0x1FF;
-        
-        if (!(hhdm_pml4[pml4_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pdpt = alloc_table(0);
-            hhdm_pml4[pml4_idx] = ((uint64_t)new_pdpt) | PAGE_PRESENT | PAGE_RW;
+        if (!pdpt) {
+            printk("[paging] init_paging: FATAL - out of memory for kernel PDPTs\n");
+            return;
         }
-        pdpt = (uint64_t*)((hhdm_pml4[pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pd = alloc_table(0);
-            pdpt[pdpt_idx] = ((uint64_t)new_pd) | PAGE_PRESENT | PAGE_RW;
-        }
-        pd = (uint64_t*)((pdpt[pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pd[pd_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pt = alloc_table(0);
-            pd[pd_idx] = ((uint64_t)new_pt) | PAGE_PRESENT | PAGE_RW;
-        }
-        pt = (uint64_t*)((pd[pd_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        pt[pt_idx] = addr | PAGE_PRESENT | PAGE_RW;
+        add_early_page_table((uint64_t)pdpt);
+        hhdm_pml4_ptr[i] = ((uint64_t)pdpt) | PAGE_PRESENT | PAGE_RW;
     }
-    
-    printk("[paging] Mapped stack pages successfully\n");
 
-    // Map the page table pages themselves in both identity and HHDM space
-    for (int i = 0; i < num_early_page_tables; i++) {
-        uint64_t pt_addr = early_page_tables[i];
-        uint64_t hhdm_pt_addr = pt_addr + kernel.hhdm;
-        
-        // Identity map
-        pml4_idx = (pt_addr >> 39) & 0x1FF;
-        pdpt_idx = (pt_addr >> 30) & 0x1FF;
-        pd_idx = (pt_addr >> 21) & 0x1FF;
-        pt_idx = (pt_addr >> 12) & 0x1FF;
-        
-        if (!(hhdm_pml4[pml4_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pdpt = alloc_table(0);
-            hhdm_pml4[pml4_idx] = ((uint64_t)new_pdpt) | PAGE_PRESENT | PAGE_RW;
-        }
-        pdpt = (uint64_t*)((hhdm_pml4[pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pd = alloc_table(0);
-            pdpt[pdpt_idx] = ((uint64_t)new_pd) | PAGE_PRESENT | PAGE_RW;
-        }
-        pd = (uint64_t*)((pdpt[pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pd[pd_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pt = alloc_table(0);
-            pd[pd_idx] = ((uint64_t)new_pt) | PAGE_PRESENT | PAGE_RW;
-        }
-        pt = (uint64_t*)((pd[pd_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        // pt_addr is both virtual and physical in identity mapping
-        uint64_t phys_pt_addr = pt_addr;
-        pt[pt_idx] = phys_pt_addr | PAGE_PRESENT | PAGE_RW;
-        printk("[paging] Mapped identity page table phys=%p\n", (void*)phys_pt_addr);
-        
-        // HHDM map
-        pml4_idx = (hhdm_pt_addr >> 39) & 0x1FF;
-        pdpt_idx = (hhdm_pt_addr >> 30) & 0x1FF;
-        pd_idx = (hhdm_pt_addr >> 21) & 0x1FF;
-        pt_idx = (hhdm_pt_addr >> 12) & 0x1FF;
-        
-        if (!(hhdm_pml4[pml4_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pdpt = alloc_table(0);
-            hhdm_pml4[pml4_idx] = ((uint64_t)new_pdpt) | PAGE_PRESENT | PAGE_RW;
-        }
-        pdpt = (uint64_t*)((hhdm_pml4[pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pdpt[pdpt_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pd = alloc_table(0);
-            pdpt[pdpt_idx] = ((uint64_t)new_pd) | PAGE_PRESENT | PAGE_RW;
-        }
-        pd = (uint64_t*)((pdpt[pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        if (!(pd[pd_idx] & PAGE_PRESENT)) {
-            uint64_t* new_pt = alloc_table(0);
-            pd[pd_idx] = ((uint64_t)new_pt) | PAGE_PRESENT | PAGE_RW;
-        }
-        pt = (uint64_t*)((pd[pd_idx] & ~0xFFFULL) + kernel.hhdm);
-        
-        // For HHDM mapping, we still need physical address
-        pt[pt_idx] = phys_pt_addr | PAGE_PRESENT | PAGE_RW;
-        printk("[paging] Mapped HHDM page table phys=%p to virt=%p\n", (void*)phys_pt_addr, (void*)hhdm_pt_addr);
-    }
-    
-    printk("[paging] Mapped all page tables successfully\n");
-    // Load PML4 into CR3
-    // 5. Map all page tables both identity and HHDM
-    printk("[paging] Mapping page tables...\n");
-    for (int i = 0; i < num_early_page_tables; i++) {
-        uint64_t pt_addr = early_page_tables[i] & ~0xFFF;
-        // Identity map
-        map_range(hhdm_pml4, pt_addr, pt_addr + 0x1000, PAGE_PRESENT | PAGE_RW);
-        // HHDM map
-        map_range(hhdm_pml4, kernel.hhdm + pt_addr, kernel.hhdm + pt_addr + 0x1000, PAGE_PRESENT | PAGE_RW);
-    }
+    printk("[paging] %zu 1GB, %zu 2MB and %zu 4KB pages in %d page tables\n",
+           mappedPages[1], mappedPages[2], mappedPages[3], num_early_page_tables);
 
-    // Verify critical page table entries before switching
-    printk("[paging] Verifying page table entries:\n");
-    
-    // Get current instruction pointer to verify code mapping
-    uint64_t current_rip;
+    // Refuse to switch if the code or the stack would vanish under us, that would only end in a triple fault
+    uint64_t current_rip, current_rsp;
     asm volatile ("lea (%%rip), %0" : "=r"(current_rip));
-    uint64_t verify_addr = current_rip & ~0xFFFULL;
-    
-    // Check code page mapping
-    int verify_pml4_i = (verify_addr >> 39) & 0x1FF;
-    int verify_pdpt_i = (verify_addr >> 30) & 0x1FF;
-    int verify_pd_i   = (verify_addr >> 21) & 0x1FF;
-    int verify_pt_i   = (verify_addr >> 12) & 0x1FF;
-    
-    volatile uint64_t* verify_pml4 = (uint64_t*)((uint64_t)pml4 + kernel.hhdm);
-    printk("[paging] Verifying address %p mapping:\n", (void*)verify_addr);
-    printk("  PML4[%d] = %p\n", verify_pml4_i, (void*)verify_pml4[verify_pml4_i]);
-    
-    if (verify_pml4[verify_pml4_i] & PAGE_PRESENT) {
-        volatile uint64_t* verify_pdpt = (uint64_t*)((verify_pml4[verify_pml4_i] & ~0xFFFULL) + kernel.hhdm);
-        printk("  PDPT[%d] = %p\n", verify_pdpt_i, (void*)verify_pdpt[verify_pdpt_i]);
-        
-        if (verify_pdpt[verify_pdpt_i] & PAGE_PRESENT) {
-            volatile uint64_t* verify_pd = (uint64_t*)((verify_pdpt[verify_pdpt_i] & ~0xFFFULL) + kernel.hhdm);
-            printk("  PD[%d] = %p\n", verify_pd_i, (void*)verify_pd[verify_pd_i]);
-            
-            if (verify_pd[verify_pd_i] & PAGE_PRESENT) {
-                volatile uint64_t* verify_pt = (uint64_t*)((verify_pd[verify_pd_i] & ~0xFFFULL) + kernel.hhdm);
-                printk("  PT[%d] = %p\n", verify_pt_i, (void*)verify_pt[verify_pt_i]);
-            }
-        }
+    asm volatile ("mov %%rsp, %0" : "=r"(current_rsp));
+    uint64_t rip_phys = virt_to_phys(current_rip);
+    uint64_t rsp_phys = virt_to_phys(current_rsp);
+    printk("[paging] rip %p -> %p, rsp %p -> %p\n", (void*)current_rip, (void*)rip_phys,
+           (void*)current_rsp, (void*)rsp_phys);
+    uint64_t current_cr3;
+    asm volatile ("mov %%cr3, %0" : "=r"(current_cr3));
+    // There is no falling back to the bootloader's tables either: they sit in bootloader reclaimable memory,
+    // which gets freed once we've booted, and address spaces copy their kernel half from the PML4 built here.
+    if (rip_phys != current_rip - kernel_virt + kernel_phys || rsp_phys != current_rsp - kernel.hhdm) {
+        printk("[paging] FATAL: new tables don't map the running code and stack, halting\n");
+        for (;;)
+            asm volatile ("cli; hlt");
     }
-    
+
     // Additional verification before CR3 load
     uint64_t phys_pml4 = (uint64_t)pml4;
-    uint64_t current_cr3;
-    asm volatile ("mov %%cr3, %0" : "=r"(current_cr3));
-    
     printk("[paging] Current CR3: %p\n", (void*)current_cr3);
     printk("[paging] About to load new CR3 (phys=%p)\n", (void*)phys_pml4);
     
@@ -398,30 +214,8 @@ void init_paging() {
         return;
     }
     
-    // Double check the identity mapping for the next instruction
-    uint64_t next_rip;
-    asm volatile ("lea 1f(%%rip), %0; 1:" : "=r"(next_rip));
-    printk("[paging] Verifying mapping for next instruction at %p\n", (void*)next_rip);
-    
-    int v_pml4_idx = (next_rip >> 39) & 0x1FF;
-    int v_pdpt_idx = (next_rip >> 30) & 0x1FF;
-    int v_pd_idx = (next_rip >> 21) & 0x1FF;
-    int v_pt_idx = (next_rip >> 12) & 0x1FF;
-    
-    volatile uint64_t* hhdm_pml4_ptr = (uint64_t*)((uint64_t)pml4 + kernel.hhdm);
-    volatile uint64_t* v_pdpt = (uint64_t*)((hhdm_pml4_ptr[v_pml4_idx] & ~0xFFFULL) + kernel.hhdm);
-    volatile uint64_t* v_pd = (uint64_t*)((v_pdpt[v_pdpt_idx] & ~0xFFFULL) + kernel.hhdm);
-    volatile uint64_t* v_pt = (uint64_t*)((v_pd[v_pd_idx] & ~0xFFFULL) + kernel.hhdm);
-    
-    printk("[paging] Next instruction mapping chain:\n");
-    printk("  PML4[%d] = %p\n", v_pml4_idx, (void*)hhdm_pml4_ptr[v_pml4_idx]);
-    printk("  PDPT[%d] = %p\n", v_pdpt_idx, (void*)v_pdpt[v_pdpt_idx]);
-    printk("  PD[%d] = %p\n", v_pd_idx, (void*)v_pd[v_pd_idx]);
-    printk("  PT[%d] = %p\n", v_pt_idx, (void*)v_pt[v_pt_idx]);
-    
-    // Flush TLB before paging change
-    asm volatile ("invlpg (%0)" :: "r"(pml4) : "memory");
-    
+    kernelPml4 = pml4;
+
     // Load CR3 with physical address of PML4
     printk("[paging] Loading CR3 with physical address %p\n", (void*)phys_pml4);
     __asm__ __volatile__ (
@@ -454,55 +248,93 @@ static void add_early_page_table(uint64_t addr) {
     }
 }
 
-static uint64_t* get_next_table(uint64_t* table, int index, int create) {
-    printk("[paging] --- Get Next Table ---\n");
-    printk("[paging] Table physical=%p index=%d create=%d\n", 
+// Replaces the large page in hhdm_table[index] (level 1 = 1 GiB, 2 = 2 MiB) with a table of the next size down
+// mapping the same memory with the same flags, so a single page inside it can be changed.
+static uint64_t* split_huge(volatile uint64_t* hhdm_table, int index, int level) {
+    uint64_t current = hhdm_table[index];
+    uint64_t* next = alloc_table(0);
+    if (!next) {
+        printk("[paging] FATAL: Failed to allocate a table to split a huge page\n");
+        return 0;
+    }
+    add_early_page_table((uint64_t)next);
+
+    uint64_t size = 1ULL << (39 - 9 * (level + 1));
+    uint64_t frame = current & 0x000FFFFFFFFFF000ULL & ~((size << 9) - 1);
+    // 2 MiB entries keep PAT where 1 GiB ones have it, but in a PT entry it moves to bit 7, the same bit as PS
+    uint64_t flags = current & (0xFFFULL | PAGE_PAT_LARGE | (1ULL << 63)) & ~(uint64_t)PAGE_HUGE;
+    if (level == 1)
+        flags |= PAGE_HUGE;
+    else if (flags & PAGE_PAT_LARGE)
+        flags = (flags & ~(uint64_t)PAGE_PAT_LARGE) | PAGE_PAT_4K;
+    volatile uint64_t* hhdm_next = (uint64_t*)((uint64_t)next + kernel.hhdm);
+    for (int i = 0; i < 512; i++)
+        hhdm_next[i] = (frame + i * size) | flags;
+
+    // same translations as before, so nothing needs flushing until the caller changes one of them
+    hhdm_table[index] = ((uint64_t)next) | PAGE_PRESENT | PAGE_RW | (current & PAGE_USER);
+    kdebug("[paging] Split huge page entry %p into table %p\n", (void*)current, next);
+    return next;
+}
+
+static uint64_t* get_next_table(uint64_t* table, int index, int level, int create) {
+    kdebug("[paging] --- Get Next Table ---\n");
+    kdebug("[paging] Table physical=%p index=%d create=%d\n", 
            table, index, create);
     
     // Access table through HHDM
     volatile uint64_t* hhdm_table = (uint64_t*)((uint64_t)table + kernel.hhdm);
-    printk("[paging] Table HHDM=%p\n", (void*)hhdm_table);
+    kdebug("[paging] Table HHDM=%p\n", (void*)hhdm_table);
     
     // Read current entry
     uint64_t current = hhdm_table[index];
-    printk("[paging] Current entry at index %d = %p\n", index, (void*)current);
+    kdebug("[paging] Current entry at index %d = %p\n", index, (void*)current);
     
     if (!(current & PAGE_PRESENT)) {
-        printk("[paging] Entry not present\n");
+        kdebug("[paging] Entry not present\n");
         if (!create) {
-            printk("[paging] Not creating new table\n");
+            kdebug("[paging] Not creating new table\n");
             return 0;
         }
         
         // Allocate new table
-        printk("[paging] Allocating new table...\n");
+        kdebug("[paging] Allocating new table...\n");
         uint64_t* next = alloc_table(0); // Don't map yet
         if (!next) {
             printk("[paging] FATAL: Failed to allocate new table\n");
             return 0;
         }
-        printk("[paging] Allocated new table at %p\n", next);
+        kdebug("[paging] Allocated new table at %p\n", next);
         
         // Add to tracking list
         add_early_page_table((uint64_t)next);
-        printk("[paging] Added to early page tables list (count=%d)\n", num_early_page_tables);
+        kdebug("[paging] Added to early page tables list (count=%d)\n", num_early_page_tables);
         
+        // address spaces copied the kernel half when they were made, they won't see this entry
+        if (level == 0 && index >= PML4_ENTRIES / 2 && kernelPml4)
+            printk("[paging] WARNING: new kernel half PML4 entry %d, outside every range init_paging() prepared\n", index);
+
         // Set up entry
         uint64_t entry = ((uint64_t)next) | PAGE_PRESENT | PAGE_RW | PAGE_USER;
-        printk("[paging] Writing entry %p to index %d\n", (void*)entry, index);
+        kdebug("[paging] Writing entry %p to index %d\n", (void*)entry, index);
         hhdm_table[index] = entry;
         
         return next;
     }
     
+    if (current & PAGE_HUGE) {
+        kdebug("[paging] Entry maps a huge page, splitting it\n");
+        return split_huge(hhdm_table, index, level);
+    }
+
     uint64_t next_table = current & ~0xFFFULL;
-    printk("[paging] Returning existing table %p\n", (void*)next_table);
+    kdebug("[paging] Returning existing table %p\n", (void*)next_table);
     return (uint64_t*)next_table;
 }
 
 void map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
-    printk("[paging] ============ Mapping Page ============\n");
-    printk("[paging] Virtual: %p Physical: %p Flags: %p\n", 
+    kdebug("[paging] ============ Mapping Page ============\n");
+    kdebug("[paging] Virtual: %p Physical: %p Flags: %p\n", 
            (void*)virt_addr, (void*)phys_addr, (void*)flags);
 
     // Calculate indices
@@ -511,46 +343,75 @@ void map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
     int pd_idx   = (virt_addr >> 21) & 0x1FF;
     int pt_idx   = (virt_addr >> 12) & 0x1FF;
     
-    printk("[paging] Table indices: PML4=%d PDPT=%d PD=%d PT=%d\n", 
+    kdebug("[paging] Table indices: PML4=%d PDPT=%d PD=%d PT=%d\n", 
            pml4_idx, pdpt_idx, pd_idx, pt_idx);
     
     // Get PDPT
-    printk("[paging] Getting PDPT from PML4[%d]...\n", pml4_idx);
-    uint64_t* pdpt = get_next_table(pml4, pml4_idx, 1);
+    kdebug("[paging] Getting PDPT from PML4[%d]...\n", pml4_idx);
+    uint64_t* pdpt = get_next_table(pml4, pml4_idx, 0, 1);
     if (!pdpt) {
         printk("[paging] FATAL: Failed to get/create PDPT\n");
         return;
     }
-    printk("[paging] Got PDPT at %p\n", pdpt);
+    kdebug("[paging] Got PDPT at %p\n", pdpt);
     
     // Get PD
-    printk("[paging] Getting PD from PDPT[%d]...\n", pdpt_idx);
-    uint64_t* pd = get_next_table(pdpt, pdpt_idx, 1);
+    kdebug("[paging] Getting PD from PDPT[%d]...\n", pdpt_idx);
+    uint64_t* pd = get_next_table(pdpt, pdpt_idx, 1, 1);
     if (!pd) {
         printk("[paging] FATAL: Failed to get/create PD\n");
         return;
     }
-    printk("[paging] Got PD at %p\n", pd);
+    kdebug("[paging] Got PD at %p\n", pd);
     
     // Get PT
-    printk("[paging] Getting PT from PD[%d]...\n", pd_idx);
-    uint64_t* pt = get_next_table(pd, pd_idx, 1);
+    kdebug("[paging] Getting PT from PD[%d]...\n", pd_idx);
+    uint64_t* pt = get_next_table(pd, pd_idx, 2, 1);
     if (!pt) {
         printk("[paging] FATAL: Failed to get/create PT\n");
         return;
     }
-    printk("[paging] Got PT at %p\n", pt);
+    kdebug("[paging] Got PT at %p\n", pt);
 
     // Set the page table entry
-    uint64_t entry = (phys_addr & ~0xFFFULL) | (flags & 0xFFF) | PAGE_PRESENT;
-    printk("[paging] Setting PT[%d] = %p\n", pt_idx, (void*)entry);
+    uint64_t entry = (phys_addr & ~0xFFFULL) | (global_for(virt_addr, flags) & 0xFFF) | PAGE_PRESENT;
+    kdebug("[paging] Setting PT[%d] = %p\n", pt_idx, (void*)entry);
     
     // Access through HHDM
     volatile uint64_t* hhdm_pt = (uint64_t*)((uint64_t)pt + kernel.hhdm);
+    bool replaced = (hhdm_pt[pt_idx] & PAGE_PRESENT) != 0;
     hhdm_pt[pt_idx] = entry;
+    // a remapped global kernel page stays in the TLB across CR3 switches, so it has to go now
+    if (replaced)
+        tlb_flush_page(virt_addr);
     
-    printk("[paging] Successfully mapped page\n");
-    printk("[paging] ====================================\n");
+    kdebug("[paging] Successfully mapped page\n");
+    kdebug("[paging] ====================================\n");
+}
+
+// Maps a 2 MiB page with a single PD entry. Both addresses must be 2 MiB aligned, and the range must not already
+// be split into 4 KiB pages (that PT would be leaked and its mappings silently dropped).
+bool map_huge(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    if ((virt_addr | phys_addr) & (HUGE_PAGE_SIZE - 1)) {
+        printk("[paging] map_huge: %p -> %p is not 2MB aligned\n", (void*)virt_addr, (void*)phys_addr);
+        return false;
+    }
+    int pml4_idx = (virt_addr >> 39) & 0x1FF;
+    int pdpt_idx = (virt_addr >> 30) & 0x1FF;
+    int pd_idx   = (virt_addr >> 21) & 0x1FF;
+    uint64_t* pdpt = get_next_table(pml4, pml4_idx, 0, 1);
+    if (!pdpt) return false;
+    uint64_t* pd = get_next_table(pdpt, pdpt_idx, 1, 1);
+    if (!pd) return false;
+
+    volatile uint64_t* hhdm_pd = (uint64_t*)((uint64_t)pd + kernel.hhdm);
+    if ((hhdm_pd[pd_idx] & PAGE_PRESENT) && !(hhdm_pd[pd_idx] & PAGE_HUGE)) {
+        printk("[paging] map_huge: %p is already mapped with 4KB pages\n", (void*)virt_addr);
+        return false;
+    }
+    hhdm_pd[pd_idx] = phys_addr | (global_for(virt_addr, flags) & 0xFFF) | PAGE_HUGE | PAGE_PRESENT;
+    tlb_flush_page(virt_addr);
+    return true;
 }
 
 void unmap_page(uint64_t virt_addr) {
@@ -558,11 +419,300 @@ void unmap_page(uint64_t virt_addr) {
     int pdpt_idx = (virt_addr >> 30) & 0x1FF;
     int pd_idx   = (virt_addr >> 21) & 0x1FF;
     int pt_idx   = (virt_addr >> 12) & 0x1FF;
-    uint64_t* pdpt = get_next_table(pml4, pml4_idx, 0);
+    uint64_t* pdpt = get_next_table(pml4, pml4_idx, 0, 0);
     if (!pdpt) return;
-    uint64_t* pd   = get_next_table(pdpt, pdpt_idx, 0);
+    uint64_t* pd   = get_next_table(pdpt, pdpt_idx, 1, 0);
     if (!pd) return;
-    uint64_t* pt   = get_next_table(pd, pd_idx, 0);
+    uint64_t* pt   = get_next_table(pd, pd_idx, 2, 0);
     if (!pt) return;
-    pt[pt_idx] = 0;
+    // tables are physical addresses, they're only reachable through the HHDM
+    volatile uint64_t* hhdm_pt = (uint64_t*)((uint64_t)pt + kernel.hhdm);
+    hhdm_pt[pt_idx] = 0;
+    tlb_flush_page(virt_addr);
+}
+
+// The PT holding the entry for virt_addr under root, creating the levels above it if create is set
+static uint64_t* walk_to_pt(uint64_t* root, uint64_t virt_addr, int create) {
+    uint64_t* pdpt = get_next_table(root, (virt_addr >> 39) & 0x1FF, 0, create);
+    if (!pdpt) return 0;
+    uint64_t* pd = get_next_table(pdpt, (virt_addr >> 30) & 0x1FF, 1, create);
+    if (!pd) return 0;
+    return get_next_table(pd, (virt_addr >> 21) & 0x1FF, 2, create);
+}
+
+// Changed entries of the loaded tables are flushed here, those of any other address space by dropping
+// everything its PCID holds.
+static void flush_after_change(uint64_t* root, struct tlbContext* tlb, uint64_t virt_addr, uint64_t count) {
+    if (root == pml4 || virt_addr >= KERNEL_SPACE_START)
+        tlb_flush_range(virt_addr, count);
+    else if (tlb)
+        tlb_flush_context(tlb);
+}
+
+// Fills count PTEs from virt_addr on, walking the upper levels once per PT rather than once per page. The frames
+// come from the frames array if there is one, else they run on from phys_addr.
+static bool map_run(uint64_t* root, struct tlbContext* tlb, uint64_t virt_addr, const uint64_t* frames,
+                    uint64_t phys_addr, uint64_t count, uint64_t flags) {
+    uint64_t done = 0;
+    bool replaced = false;
+    flags = global_for(virt_addr, flags);
+    while (done < count) {
+        uint64_t addr = virt_addr + done * PAGE_SIZE;
+        uint64_t* pt = walk_to_pt(root, addr, 1);
+        if (!pt) {
+            printk("[paging] FATAL: Failed to get/create PT for %p\n", (void*)addr);
+            break;
+        }
+        volatile uint64_t* hhdm_pt = (uint64_t*)((uint64_t)pt + kernel.hhdm);
+        int first = (addr >> 12) & 0x1FF;
+        uint64_t n = PTE_ENTRIES - first;
+        if (n > count - done)
+            n = count - done;
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t frame = frames ? frames[done + i] : phys_addr + (done + i) * PAGE_SIZE;
+            replaced |= (hhdm_pt[first + i] & PAGE_PRESENT) != 0;
+            hhdm_pt[first + i] = (frame & ~0xFFFULL) | (flags & 0xFFF) | PAGE_PRESENT;
+        }
+        done += n;
+    }
+    // entries that weren't present can't be in the TLB, only remapping needs a flush
+    if (replaced)
+        flush_after_change(root, tlb, virt_addr, done);
+    return done == count;
+}
+
+static void unmap_run(uint64_t* root, struct tlbContext* tlb, uint64_t virt_addr, uint64_t count) {
+    uint64_t done = 0;
+    while (done < count) {
+        uint64_t addr = virt_addr + done * PAGE_SIZE;
+        int first = (addr >> 12) & 0x1FF;
+        uint64_t n = PTE_ENTRIES - first;
+        if (n > count - done)
+            n = count - done;
+        uint64_t* pt = walk_to_pt(root, addr, 0);
+        if (pt) {
+            volatile uint64_t* hhdm_pt = (uint64_t*)((uint64_t)pt + kernel.hhdm);
+            for (uint64_t i = 0; i < n; i++)
+                hhdm_pt[first + i] = 0;
+        }
+        done += n;
+    }
+    flush_after_change(root, tlb, virt_addr, count);
+}
+
+static uint64_t translate(uint64_t* root, uint64_t virt_addr) {
+    int shifts[] = {39, 30, 21, 12};
+    uint64_t table = (uint64_t)root;
+    for (int level = 0; level < 4; level++) {
+        uint64_t entry = ((volatile uint64_t*)(table + kernel.hhdm))[(virt_addr >> shifts[level]) & 0x1FF];
+        if (!(entry & PAGE_PRESENT))
+            return 0;
+        uint64_t frame = entry & 0x000FFFFFFFFFF000ULL;
+        // a PS entry in the PDPT or PD maps the rest of the address directly
+        if (level == 3 || (level > 0 && (entry & PAGE_HUGE))) {
+            uint64_t offset_mask = (1ULL << shifts[level]) - 1;
+            return (frame & ~offset_mask) | (virt_addr & offset_mask);
+        }
+        table = frame;
+    }
+    return 0;
+}
+
+// Maps count pages from virt_addr to the physically contiguous range at phys_addr.
+bool map_pages(uint64_t virt_addr, uint64_t phys_addr, uint64_t count, uint64_t flags) {
+    return map_run(pml4, NULL, virt_addr, NULL, phys_addr, count, flags);
+}
+
+// Maps count pages from virt_addr to frames[0], frames[1], ... which needn't be contiguous.
+bool map_page_list(uint64_t virt_addr, const uint64_t* frames, uint64_t count, uint64_t flags) {
+    return map_run(pml4, NULL, virt_addr, frames, 0, count, flags);
+}
+
+// Clears count PTEs from virt_addr on, skipping the parts that have no PT, then makes one flush decision for the
+// whole range.
+void unmap_pages(uint64_t virt_addr, uint64_t count) {
+    unmap_run(pml4, NULL, virt_addr, count);
+}
+
+// Walks the tables for virt_addr. Returns the physical address it maps to, or 0 if it isn't mapped.
+uint64_t virt_to_phys(uint64_t virt_addr) {
+    return translate(pml4, virt_addr);
+}
+
+// The same three for the tables at root, which need not be the loaded ones. tlb is the PCID they run under.
+bool map_page_list_in(uint64_t root, struct tlbContext* tlb, uint64_t virt_addr, const uint64_t* frames,
+                      uint64_t count, uint64_t flags) {
+    return map_run((uint64_t*)root, tlb, virt_addr, frames, 0, count, flags);
+}
+
+void unmap_pages_in(uint64_t root, struct tlbContext* tlb, uint64_t virt_addr, uint64_t count) {
+    unmap_run((uint64_t*)root, tlb, virt_addr, count);
+}
+
+uint64_t virt_to_phys_in(uint64_t root, uint64_t virt_addr) {
+    return translate((uint64_t*)root, virt_addr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// Address space roots. Entries 256-511 of every PML4 are the kernel half, copied from the kernel's own PML4.
+// init_paging() gives every kernel range a PDPT up front, so nothing mapped there later can be missing from a
+// PML4 made before it. Entries 0-255 are the user half and belong to the root alone.
+//
+
+#define USER_PML4_ENTRIES 256
+
+uint64_t paging_kernel_root() {
+    return (uint64_t)kernelPml4;
+}
+
+// Only for the tables mapped from level (0 = PML4) down. Large pages only exist below the PML4.
+static inline bool is_leaf(uint64_t entry, int level) {
+    return level == 3 || (level > 0 && (entry & PAGE_HUGE));
+}
+
+static inline uint64_t leaf_frame(uint64_t entry, int level) {
+    return entry & 0x000FFFFFFFFFF000ULL & ~((1ULL << (39 - 9 * level)) - 1);
+}
+
+// A new PML4 with the kernel half and an empty user half. Returns its physical address, or 0.
+uint64_t paging_new_root() {
+    uint64_t* root = alloc_table(0);
+    if (!root)
+        return 0;
+    volatile uint64_t* hhdm_root = (uint64_t*)((uint64_t)root + kernel.hhdm);
+    volatile uint64_t* hhdm_kernel = (uint64_t*)((uint64_t)kernelPml4 + kernel.hhdm);
+    for (int i = USER_PML4_ENTRIES; i < PML4_ENTRIES; i++)
+        hhdm_root[i] = hhdm_kernel[i];
+    return (uint64_t)root;
+}
+
+// Frees the user half below table, the frames its leaves map included, and then table itself.
+static void free_user_tables(uint64_t table, int level, int entries) {
+    volatile uint64_t* hhdm_table = (uint64_t*)(table + kernel.hhdm);
+    for (int i = 0; i < entries; i++) {
+        uint64_t entry = hhdm_table[i];
+        if (!(entry & PAGE_PRESENT))
+            continue;
+        if (!is_leaf(entry, level))
+            free_user_tables(entry & 0x000FFFFFFFFFF000ULL, level + 1, PTE_ENTRIES);
+        else if (level == 3)
+            page_release(leaf_frame(entry, level), 0); // the frame may still be shared with a clone
+        else if (level == 2)
+            free_huge_page(leaf_frame(entry, level));
+        // nothing hands out 1 GiB user pages, and the PMM couldn't take one back
+    }
+    free_pages(table, 0);
+}
+
+// Frees everything in the user half of root and root itself. root must not be loaded, and the TLB must have
+// been flushed of it.
+void paging_free_root(uint64_t root) {
+    free_user_tables(root, 0, USER_PML4_ENTRIES);
+}
+
+// Gives every present entry of src a copy in dst: tables become new tables, and 4 KiB frames are shared, with
+// the writable ones turned read only on both sides and marked PAGE_COW for paging_cow_fault(). 2 MiB pages,
+// and frames whose share count is full, are copied outright. Entries are filled in as they are made, so a
+// copy that runs out of memory can still be freed.
+static bool clone_user_tables(volatile uint64_t* dst, volatile uint64_t* src, int level, int entries) {
+    for (int i = 0; i < entries; i++) {
+        uint64_t entry = src[i];
+        if (!(entry & PAGE_PRESENT))
+            continue;
+        uint64_t flags = entry & ~0x000FFFFFFFFFF000ULL;
+        if (level == 3 && page_share(leaf_frame(entry, level))) {
+            if (entry & PAGE_RW) {
+                entry = (entry & ~(uint64_t)PAGE_RW) | PAGE_COW;
+                src[i] = entry;
+            }
+            dst[i] = entry;
+            continue;
+        }
+        if (is_leaf(entry, level)) {
+            if (level == 1)
+                return false;
+            uint64_t frame = level == 3 ? alloc_pages(0) : alloc_huge_page();
+            if (!frame)
+                return false;
+            uint64_t bytes = level == 3 ? PAGE_SIZE : HUGE_PAGE_SIZE;
+            simd_memcpy((void*)(frame + kernel.hhdm), (void*)(leaf_frame(entry, level) + kernel.hhdm), bytes);
+            dst[i] = frame | (flags & ~(uint64_t)(bytes - 1)) | (entry & 0xFFF);
+            continue;
+        }
+        uint64_t* next = alloc_table(0);
+        if (!next)
+            return false;
+        dst[i] = (uint64_t)next | flags;
+        volatile uint64_t* hhdm_next = (uint64_t*)((uint64_t)next + kernel.hhdm);
+        volatile uint64_t* hhdm_src = (uint64_t*)((entry & 0x000FFFFFFFFFF000ULL) + kernel.hhdm);
+        if (!clone_user_tables(hhdm_next, hhdm_src, level + 1, PTE_ENTRIES))
+            return false;
+    }
+    return true;
+}
+
+// A new root whose user half maps the same frames as src's, copy-on-write. Only the tables are copied up
+// front. src loses write access to its pages too, so whatever src_tlb holds of it is dropped. Returns the
+// new root's physical address, or 0.
+uint64_t paging_clone_root(uint64_t src, struct tlbContext* src_tlb) {
+    uint64_t root = paging_new_root();
+    if (!root)
+        return 0;
+    bool cloned = clone_user_tables((uint64_t*)(root + kernel.hhdm), (uint64_t*)(src + kernel.hhdm), 0,
+                                    USER_PML4_ENTRIES);
+    // a half finished clone has already write protected part of src
+    if (src_tlb)
+        tlb_flush_context(src_tlb);
+    else
+        tlb_flush_all();
+    if (!cloned) {
+        printk("[paging] paging_clone_root: out of memory copying %p\n", (void*)src);
+        paging_free_root(root);
+        return 0;
+    }
+    return root;
+}
+
+// Handles a write to a present page of root, which must be the loaded tables. If the PTE is PAGE_COW, the
+// last owner of the frame just gets write access back, and anyone else gets a copy of their own. Returns false
+// if the page wasn't copy-on-write or there was no memory for the copy.
+bool paging_cow_fault(uint64_t root, struct tlbContext* tlb, uint64_t virt_addr) {
+    int shifts[] = {39, 30, 21};
+    uint64_t table = root;
+    for (int level = 0; level < 3; level++) {
+        uint64_t entry = ((volatile uint64_t*)(table + kernel.hhdm))[(virt_addr >> shifts[level]) & 0x1FF];
+        if (!(entry & PAGE_PRESENT) || is_leaf(entry, level))
+            return false;
+        table = entry & 0x000FFFFFFFFFF000ULL;
+    }
+    volatile uint64_t* pte = (uint64_t*)(table + kernel.hhdm) + ((virt_addr >> 12) & 0x1FF);
+    uint64_t entry = *pte;
+    if (!(entry & PAGE_PRESENT) || !(entry & PAGE_COW))
+        return false;
+
+    uint64_t frame = leaf_frame(entry, 3);
+    uint64_t flags = (entry & 0xFFF & ~(uint64_t)PAGE_COW) | PAGE_RW;
+    if (page_is_shared(frame)) {
+        uint64_t copy = alloc_pages(0);
+        if (!copy) {
+            printk("[paging] out of memory copying %p on write\n", (void*)(virt_addr & ~0xFFFULL));
+            return false;
+        }
+        simd_memcpy((void*)(copy + kernel.hhdm), (void*)(frame + kernel.hhdm), PAGE_SIZE);
+        *pte = copy | flags | (entry & ~0x000FFFFFFFFFFFFFULL);
+        page_release(frame, 0);
+    } else {
+        *pte = frame | flags | (entry & ~0x000FFFFFFFFFFFFFULL);
+    }
+    // drop the read only translation, in case the fault didn't
+    flush_after_change((uint64_t*)root, tlb, virt_addr & ~0xFFFULL, 1);
+    return true;
+}
+
+// Loads root under tlb's PCID. Everything map_page() and friends do from now on goes to root.
+void paging_switch(uint64_t root, struct tlbContext* tlb) {
+    uint64_t flags = irq_save();
+    pml4 = (uint64_t*)root;
+    tlb_switch(tlb, root);
+    irq_restore(flags);
 }
@@ -2,9 +2,12 @@
 #define PAGING_H
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 // Page size for x86_64
 #define PAGE_SIZE 4096
+// A PD entry with PAGE_HUGE set maps this much directly, without a PT
+#define HUGE_PAGE_SIZE 0x200000
 
 // Paging structures
 #define PML4_ENTRIES 512
@@ -16,10 +19,39 @@
 #define PAGE_PRESENT 0x1
 #define PAGE_RW      0x2
 #define PAGE_USER    0x4
+#define PAGE_HUGE    0x80 // PS, only valid in PD (2 MiB) and PDPT (1 GiB) entries
+#define PAGE_GLOBAL  0x100 // kept across CR3 switches once CR4.PGE is on, for kernel half mappings
+#define PAGE_COW     0x200 // one of the bits left to software: read only for now, copied on the first write
+// PAT selects the memory type together with PCD and PWT. Large page entries keep it in bit 12, since bit 7 is PS
+#define PAGE_PAT_4K    0x80
+#define PAGE_PAT_LARGE 0x1000
+
+// Everything from here up is the kernel's, and is mapped global
+#define KERNEL_SPACE_START 0xFFFF800000000000ULL
+// and everything below this belongs to the address space (PML4 entries 0-255)
+#define USER_SPACE_END 0x0000800000000000ULL
 
 // Paging API
 void init_paging();
 void map_page(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
 void unmap_page(uint64_t virt_addr);
+bool map_pages(uint64_t virt_addr, uint64_t phys_addr, uint64_t count, uint64_t flags);
+bool map_page_list(uint64_t virt_addr, const uint64_t* frames, uint64_t count, uint64_t flags);
+void unmap_pages(uint64_t virt_addr, uint64_t count);
+bool map_huge(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+uint64_t virt_to_phys(uint64_t virt_addr);
+
+// Tables other than the loaded ones, for address spaces (kernel/address_space.h)
+struct tlbContext;
+bool map_page_list_in(uint64_t root, struct tlbContext* tlb, uint64_t virt_addr, const uint64_t* frames,
+                      uint64_t count, uint64_t flags);
+void unmap_pages_in(uint64_t root, struct tlbContext* tlb, uint64_t virt_addr, uint64_t count);
+uint64_t virt_to_phys_in(uint64_t root, uint64_t virt_addr);
+uint64_t paging_kernel_root();
+uint64_t paging_new_root();
+uint64_t paging_clone_root(uint64_t src, struct tlbContext* src_tlb);
+bool paging_cow_fault(uint64_t root, struct tlbContext* tlb, uint64_t virt_addr);
+void paging_free_root(uint64_t root);
+void paging_switch(uint64_t root, struct tlbContext* tlb);
 
 #endif
@@ -10,6 +10,7 @@
 #include <kernel/printk.h>
 #include <kernel/panic.h>
 #include <kernel/kernel.h>
+#include <kernel/vma.h>
 #include <limine.h>
 
 struct elfSectionHeader {
@@ -95,6 +96,9 @@ struct stackFrame {
 };
 
 void exceptionHandler(struct IDTEFrame registers) {
+    // first touch of a reserved page or a write to a copy-on-write one, baseHandler's iretq retries the access
+    if (registers.type == 14 && vma_handle_fault(registers.cr2, registers.code))
+        return;
     printk("[argaldOS:kernel:COR] KERNEL PANIC!\n");
     printk("\nException occurred. RIP: 0x%x\n", registers.rip);
     char labelDesignate[30];
@@ -1,6 +1,12 @@
 /* Allocator for the SpecOS kernel project.
  * Copyright (C) 2024 Jake Steinburger under the MIT license. See the GitHub repository for more information.
- * This uses a simple bitmap allocator for 4096 byte size page frames, but I may switch to a buddy allocator in the future.
+ * This uses a binary buddy allocator for 4096 byte size page frames. Blocks of 2^order frames are kept in
+ * per-order free lists, split on allocation and coalesced with their buddy on free.
+ * Every usable memory map region is managed, and regions are grouped into DMA (< 16 MiB),
+ * DMA32 (< 4 GiB) and normal zones so callers can ask for frames a device is able to reach.
+ * The buddy lists are shared by every CPU behind one lock. Single frames, by far the most common request,
+ * are served from a small per CPU magazine in front of them instead, which is refilled and drained in batches.
+ * The idle loop also keeps a pool of frames that are already zeroed, for callers of alloc_zeroed_page().
  */
 
 #include <stdint.h>
@@ -8,20 +14,91 @@
 #include <kernel/kernel.h>
 #include <kernel/printk.h>
 #include <kernel/mem.h>
-#include <stdlib/binop.h>
+#include <kernel/pmm.h>
+#include <kernel/cpu.h>
+#include <kernel/spinlock.h>
+#include <kernel/init.h>
+#include <kernel/simd.h>
 #include <stdlib/string.h>
 
-// just a basic utility
-static uint8_t setBit(uint8_t byte, uint8_t bitPosition, bool setTo) {
-    if (bitPosition < 8) {
-        if (setTo)
-            return byte |= (1 << bitPosition);
-        else 
-            return byte &= ~(1 << bitPosition);
-    } else {
-        return byte;
-    }
-}
+#define FRAME_SIZE 4096
+#define FRAME_SHIFT 12
+
+// the real mode IVT, BDA, EBDA and friends live below this, so we leave it alone
+#define PMM_LOW_MEMORY_LIMIT 0x100000
+
+#define PMM_MAX_REGIONS 64
+
+// a magazine holds up to MAGAZINE_SIZE single frames and moves MAGAZINE_BATCH of them to or from the buddy lists
+// at a time, so a CPU alternating between alloc and free around a boundary doesn't take the lock on every call
+#define MAGAZINE_SIZE 64
+#define MAGAZINE_BATCH 32
+
+// 1 MiB of frames zeroed ahead of time by the idle loop
+#define ZERO_POOL_SIZE 256
+
+// one of these per page frame, stored at the start of the region it describes
+struct pageFrame {
+    uint8_t order; // order of the block this frame heads (only meaningful for block heads and slab frames)
+    uint8_t flags; // FRAME_* from pmm.h
+    uint16_t shared; // mappings of the frame besides the first, see page_share()
+};
+
+// free blocks are linked through their own first bytes, accessed through the HHDM
+struct freeBlock {
+    struct freeBlock *next;
+    struct freeBlock *prev;
+};
+
+// a physically contiguous run of frames, fully inside a single zone
+struct pmmRegion {
+    uint64_t startFrame; // first allocatable frame number (after the metadata)
+    uint64_t endFrame;   // one past the last allocatable frame number
+    struct pageFrame *frames;
+    uint8_t zone;
+};
+
+struct buddyZone {
+    struct freeBlock *freeLists[PMM_MAX_ORDER];
+    uint64_t freeCount[PMM_MAX_ORDER];
+    uint32_t orderMask; // bit n set when freeLists[n] is not empty
+    uint64_t totalFrames;
+    uint64_t reservedFrames;
+};
+
+// order 0 frames owned by one CPU, only ever touched by that CPU with interrupts off.
+// Aligned so two CPUs never share a cache line.
+struct frameMagazine {
+    uint32_t count;
+    uint64_t frames[MAGAZINE_SIZE]; // physical addresses
+    // statistics are kept per CPU too, pmm_get_stats() adds them up
+    uint64_t allocCount;
+    uint64_t freeCount;
+} __attribute__((aligned(64)));
+
+static struct buddyZone zones[PMM_ZONE_COUNT] = {0};
+// protects zones[] and the FRAME_FREE/order metadata of free blocks
+static spinlock_t buddyLock = SPINLOCK_INIT;
+static struct frameMagazine magazines[MAX_CPUS] = {0};
+
+static uint64_t zeroedFrames[ZERO_POOL_SIZE];
+static uint32_t zeroedCount = 0;
+static spinlock_t zeroedLock = SPINLOCK_INIT;
+// kept sorted by startFrame so the owner of a frame can be binary searched
+static struct pmmRegion regions[PMM_MAX_REGIONS] = {0};
+static int regionCount = 0;
+
+static const uint64_t zoneLimits[PMM_ZONE_COUNT] = {
+    [ZONE_DMA] = 0x1000000,      // 16 MiB, legacy ISA DMA
+    [ZONE_DMA32] = 0x100000000,  // 4 GiB, 32 bit bus masters
+    [ZONE_NORMAL] = UINT64_MAX,
+};
+
+static const char* zoneNames[PMM_ZONE_COUNT] = {
+    [ZONE_DMA] = "DMA",
+    [ZONE_DMA32] = "DMA32",
+    [ZONE_NORMAL] = "Normal",
+};
 
 // Map memory at a specific address (if not already used). Returns pointer or NULL.
 void* map_at_addr(uint64_t addr, uint64_t size) {
@@ -32,117 +109,510 @@ void* map_at_addr(uint64_t addr, uint64_t size) {
     return (void*)(addr + kernel.hhdm);
 }
 
-struct pmemBitmap {
-    uint8_t bitmap[0];
-};
+static struct pmmRegion* find_region(uint64_t frame) {
+    int low = 0;
+    int high = regionCount - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (frame < regions[mid].startFrame)
+            high = mid - 1;
+        else if (frame >= regions[mid].endFrame)
+            low = mid + 1;
+        else
+            return &regions[mid];
+    }
+    return NULL;
+}
 
-struct pmemData {
-    uint8_t data[0];
-};
+static inline struct pageFrame* frame_meta(struct pmmRegion *region, uint64_t frame) {
+    return &region->frames[frame - region->startFrame];
+}
+
+static inline struct freeBlock* frame_to_block(uint64_t frame) {
+    return (struct freeBlock*)((frame << FRAME_SHIFT) + kernel.hhdm);
+}
+
+static inline uint64_t block_to_frame(struct freeBlock *block) {
+    return ((uint64_t)block - kernel.hhdm) >> FRAME_SHIFT;
+}
 
-void initPMM() {
+// Frames in a magazine or the zero pool aren't in the buddy lists, FRAME_CACHED is what tells them apart from
+// allocated ones. Returns false if addr isn't a frame the PMM manages.
+static bool set_cached(uint64_t addr, bool cached) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    if (!region)
+        return false;
+    struct pageFrame *meta = frame_meta(region, addr >> FRAME_SHIFT);
+    if (cached)
+        meta->flags |= FRAME_CACHED;
+    else
+        meta->flags &= ~FRAME_CACHED;
+    return true;
+}
+
+static void push_block(struct pmmRegion *region, uint64_t frame, uint8_t order) {
+    struct buddyZone *zone = &zones[region->zone];
+    struct freeBlock *block = frame_to_block(frame);
+    block->prev = NULL;
+    block->next = zone->freeLists[order];
+    if (block->next)
+        block->next->prev = block;
+    zone->freeLists[order] = block;
+    zone->freeCount[order]++;
+    zone->orderMask |= 1U << order;
+    struct pageFrame *meta = frame_meta(region, frame);
+    meta->order = order;
+    meta->flags |= FRAME_FREE;
+}
+
+static void remove_block(struct pmmRegion *region, uint64_t frame, uint8_t order) {
+    struct buddyZone *zone = &zones[region->zone];
+    struct freeBlock *block = frame_to_block(frame);
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        zone->freeLists[order] = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    if (--zone->freeCount[order] == 0)
+        zone->orderMask &= ~(1U << order);
+    frame_meta(region, frame)->flags &= ~FRAME_FREE;
+}
+
+// Hand every frame of a region to the free lists as the largest naturally aligned blocks that fit.
+static void free_region(struct pmmRegion *region) {
+    uint64_t frame = region->startFrame;
+    while (frame < region->endFrame) {
+        uint8_t order = PMM_MAX_ORDER - 1;
+        while (order > 0 && ((frame & ((1ULL << order) - 1)) != 0 || frame + (1ULL << order) > region->endFrame))
+            order--;
+        push_block(region, frame, order);
+        frame += 1ULL << order;
+    }
+}
+
+// Registers [base, base + length) with the zone it belongs to. The caller makes sure it doesn't cross a zone limit.
+static void add_zone_region(uint64_t base, uint64_t length, uint8_t zoneIndex) {
+    if (regionCount == PMM_MAX_REGIONS) {
+        printk("[PMM] Too many memory regions, ignoring %p-%p\n", (void*)base, (void*)(base + length));
+        return;
+    }
+    // the per frame metadata array lives at the start of the region and is never handed out
+    uint64_t total_frames = length / FRAME_SIZE;
+    uint64_t meta_frames = (total_frames * sizeof(struct pageFrame) + FRAME_SIZE - 1) / FRAME_SIZE;
+    if (total_frames <= meta_frames)
+        return;
+
+    // insertion keeps the array sorted
+    int slot = regionCount;
+    while (slot > 0 && regions[slot - 1].startFrame > (base >> FRAME_SHIFT)) {
+        regions[slot] = regions[slot - 1];
+        slot--;
+    }
+    struct pmmRegion *region = &regions[slot];
+    region->startFrame = (base >> FRAME_SHIFT) + meta_frames;
+    region->endFrame = (base >> FRAME_SHIFT) + total_frames;
+    region->frames = (struct pageFrame*)(base + kernel.hhdm);
+    region->zone = zoneIndex;
+    memset(region->frames, 0, meta_frames * FRAME_SIZE);
+    regionCount++;
+    zones[zoneIndex].reservedFrames += meta_frames;
+
+    zones[zoneIndex].totalFrames += region->endFrame - region->startFrame;
+    free_region(region);
+    printk("[PMM] Zone %s: managing %p-%p (%d frames, %d metadata frames)\n", zoneNames[zoneIndex],
+           (void*)(region->startFrame << FRAME_SHIFT), (void*)(region->endFrame << FRAME_SHIFT),
+           region->endFrame - region->startFrame, meta_frames);
+}
+
+// Counts [base, base + length) as reserved in every zone it touches, or stops counting it.
+static void count_reserved(uint64_t base, uint64_t length, bool reserved) {
+    uint64_t end = base + length;
+    uint64_t zoneBase = 0;
+    for (uint8_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        uint64_t from = base > zoneBase ? base : zoneBase;
+        uint64_t to = end < zoneLimits[z] ? end : zoneLimits[z];
+        if (from < to && reserved)
+            zones[z].reservedFrames += (to - from) / FRAME_SIZE;
+        else if (from < to)
+            zones[z].reservedFrames -= (to - from) / FRAME_SIZE;
+        zoneBase = zoneLimits[z];
+    }
+}
+
+// Gives a range of physical memory to the allocator, splitting it at the zone limits.
+void pmm_add_region(uint64_t base, uint64_t length) {
+    uint64_t end = (base + length) & ~(uint64_t)(FRAME_SIZE - 1);
+    base = (base + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+    if (base < PMM_LOW_MEMORY_LIMIT) {
+        count_reserved(base, (end < PMM_LOW_MEMORY_LIMIT ? end : PMM_LOW_MEMORY_LIMIT) - base, true);
+        base = PMM_LOW_MEMORY_LIMIT;
+    }
+    for (uint8_t z = 0; z < PMM_ZONE_COUNT && base < end; z++) {
+        if (base >= zoneLimits[z])
+            continue;
+        uint64_t pieceEnd = end < zoneLimits[z] ? end : zoneLimits[z];
+        add_zone_region(base, pieceEnd - base, z);
+        base = pieceEnd;
+    }
+}
+
+__init void initPMM() {
     printk("[argaldOS:kernel:PMM] Starting Physical Memory Manager (PMM)...\n");
     // get the memmap
     uint64_t memmapEntriesCount = kernel.memmapEntryCount;
     struct limine_memmap_entry **memmapEntries = kernel.memmapEntries;
-    uint64_t maxBegin = 0;
-    uint64_t maxLength = 0;
-    
-    // Find the largest available entry to use for allocation
+
     for (uint64_t i = 0; i < memmapEntriesCount; i++) {
-        printk("[PMM] Memory region %d: base=%p len=%p type=%d\n", 
-               i, (void*)memmapEntries[i]->base, 
-               (void*)memmapEntries[i]->length, 
+        printk("[PMM] Memory region %d: base=%p len=%p type=%d\n",
+               i, (void*)memmapEntries[i]->base,
+               (void*)memmapEntries[i]->length,
                memmapEntries[i]->type);
-        if (memmapEntries[i]->type == LIMINE_MEMMAP_USABLE &&
-            memmapEntries[i]->length > maxLength &&
-            memmapEntries[i]->base >= 0x100000) { // Start after 1MB
-            maxBegin = memmapEntries[i]->base;
-            maxLength = memmapEntries[i]->length;
-        }   
-    }
-    printk("[PMM] Selected memory region: base=%p len=%p\n", (void*)maxBegin, (void*)maxLength);
-    kernel.largestSect.maxBegin = maxBegin;
-    kernel.largestSect.maxLength = maxLength;
-
-    // Calculate bitmap size needed
-    uint64_t total_pages = maxLength / 4096;
-    uint64_t bitmap_bytes = (total_pages + 7) / 8; // Round up to nearest byte
-    uint64_t bitmap_pages = (bitmap_bytes + 4095) / 4096; // Round up to nearest page
-    uint64_t bitmapReserved = bitmap_pages * 4096;
-    
-    printk("[PMM] Bitmap info: total_pages=%d bitmap_bytes=%d bitmap_pages=%d reserved=%d\n",
-           total_pages, bitmap_bytes, bitmap_pages, bitmapReserved);
-    
-    kernel.largestSect.bitmapReserved = bitmapReserved;
-    
-    // Zero the entire bitmap region
-    volatile uint8_t* bitmap = (uint8_t*)(maxBegin + kernel.hhdm);
-    memset((void*)bitmap, 0, bitmapReserved);
-    // Mark bitmap region as used in the bitmap itself
-    // bitmap_pages was already calculated above
-    for (uint64_t i = 0; i < bitmap_pages; i++) {
-        uint64_t byte_index = i / 8;
-        uint64_t bit_index = i % 8;
-        bitmap[byte_index] = setBit(bitmap[byte_index], bit_index, 1);
-    }
-    
-    printk("[PMM] Reserved %d pages for bitmap at %p\n", bitmap_pages, (void*)maxBegin);
-    printk("[PMM] First allocatable page at %p\n", (void*)(maxBegin + bitmapReserved));
+        if (memmapEntries[i]->type == LIMINE_MEMMAP_USABLE)
+            pmm_add_region(memmapEntries[i]->base, memmapEntries[i]->length);
+        else if (memmapEntries[i]->type != LIMINE_MEMMAP_BAD_MEMORY)
+            count_reserved(memmapEntries[i]->base, memmapEntries[i]->length, true);
+    }
+
+    for (int z = 0; z < PMM_ZONE_COUNT; z++)
+        printk("[PMM] Zone %s: %d frames\n", zoneNames[z], zones[z].totalFrames);
     printk("[argaldOS:kernel:PMM] Successfully initialized physical memory allocator.\n");
 }
 
-// Ooh, fancy! Dynamic memory management, kmalloc and kfree!
-// something I gotta remember sometimes is that, unlike userspace heap malloc,
-// this doesn't take a size. It will always allocate 1024 bytes
-void* kmalloc() {
-    printk("[PMM] kmalloc: maxBegin=%p maxLength=%x bitmapReserved=%x hhdm=%p\n", 
-           (void*)kernel.largestSect.maxBegin, kernel.largestSect.maxLength, 
-           kernel.largestSect.bitmapReserved, (void*)kernel.hhdm);
-    
-    // Calculate bitmap base address correctly
-    uint8_t* bitmap_base = (uint8_t*)(kernel.largestSect.maxBegin + kernel.hhdm);
-    
-    // Calculate start of allocatable memory (after bitmap)
-    uint64_t data_start = kernel.largestSect.maxBegin + kernel.largestSect.bitmapReserved;
-    
-    // Search for a free page
-    for (int b = 0; b < kernel.largestSect.bitmapReserved; b++) {
-        uint8_t* bitmap_ptr = bitmap_base + b;
-        for (int y = 0; y < 8; y++) {
-            if (!getBit(*bitmap_ptr, y)) {
-                // Mark page as used
-                *bitmap_ptr = setBit(*bitmap_ptr, y, 1);
-                
-                // Calculate physical address after bitmap region
-                uint64_t frame_index = (b * 8) + y;
-                void* addr = (void*)(data_start + (frame_index * 4096));
-                
-                printk("[PMM] kmalloc: allocated addr=%p (frame=%d)\n", addr, frame_index);
-                return addr;
-            }
+// Hands memory that was reserved at boot (bootloader data, init sections) to the allocator.
+void pmm_reclaim(uint64_t base, uint64_t length) {
+    uint64_t flags = spin_lock_irqsave(&buddyLock);
+    count_reserved(base, length, false);
+    pmm_add_region(base, length);
+    spin_unlock_irqrestore(&buddyLock, flags);
+}
+
+// Frees every bootloader reclaimable memmap entry except the one holding keep, which is the stack
+// Limine gave us and which kernel_start is still running on.
+// Everything the kernel needs from the Limine responses must have been copied out before this.
+void pmm_reclaim_bootloader(uint64_t keep) {
+    uint64_t reclaimed = 0;
+    for (uint64_t i = 0; i < kernel.memmapEntryCount; i++) {
+        struct limine_memmap_entry *entry = kernel.memmapEntries[i];
+        if (entry->type != LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE)
+            continue;
+        if (keep >= entry->base && keep < entry->base + entry->length) {
+            printk("[PMM] Keeping bootloader region %p-%p, it holds the boot stack\n",
+                   (void*)entry->base, (void*)(entry->base + entry->length));
+            continue;
+        }
+        pmm_reclaim(entry->base, entry->length);
+        reclaimed += entry->length;
+    }
+    printk("[PMM] Reclaimed %d KB of bootloader memory\n", reclaimed / 1024);
+}
+
+static uint64_t alloc_from_zone(uint8_t zoneIndex, uint8_t order) {
+    struct buddyZone *zone = &zones[zoneIndex];
+    // the smallest order that can satisfy the request is the lowest set bit at or above it,
+    // so finding it is a single bit scan rather than a walk over the lists
+    uint32_t candidates = zone->orderMask >> order;
+    if (!candidates)
+        return 0;
+    uint8_t current = order + __builtin_ctz(candidates);
+    uint64_t frame = block_to_frame(zone->freeLists[current]);
+    struct pmmRegion *region = find_region(frame);
+    remove_block(region, frame, current);
+    // split down, giving the upper halves back to the lower order lists
+    while (current > order) {
+        current--;
+        push_block(region, frame + (1ULL << current), current);
+    }
+    frame_meta(region, frame)->order = order;
+    return frame << FRAME_SHIFT;
+}
+
+static uint64_t buddy_alloc(uint8_t order, uint8_t zone) {
+    for (int z = zone; z >= 0; z--) {
+        uint64_t addr = alloc_from_zone(z, order);
+        if (addr)
+            return addr;
+    }
+    return 0;
+}
+
+// Merges a block with its buddy for as long as the buddy is free too. Caller holds buddyLock.
+static void buddy_free(uint64_t addr, uint8_t order) {
+    uint64_t frame = addr >> FRAME_SHIFT;
+    struct pmmRegion *region = find_region(frame);
+    if (order >= PMM_MAX_ORDER || !region || frame + (1ULL << order) > region->endFrame) {
+        printk("[PMM] free_pages: %p (order %d) is not managed by the PMM\n", (void*)addr, order);
+        return;
+    }
+    if (frame_meta(region, frame)->flags & FRAME_FREE) {
+        printk("[PMM] free_pages: double free of %p\n", (void*)addr);
+        return;
+    }
+    while (order < PMM_MAX_ORDER - 1) {
+        uint64_t buddy = frame ^ (1ULL << order);
+        if (buddy < region->startFrame || buddy + (1ULL << order) > region->endFrame)
+            break;
+        struct pageFrame *buddyMeta = frame_meta(region, buddy);
+        if (!(buddyMeta->flags & FRAME_FREE) || buddyMeta->order != order)
+            break;
+        remove_block(region, buddy, order);
+        frame &= ~(1ULL << order);
+        order++;
+    }
+    push_block(region, frame, order);
+}
+
+// Tops up an empty magazine with one batch of frames. Returns how many it got.
+static uint32_t magazine_refill(struct frameMagazine *mag) {
+    spin_lock(&buddyLock);
+    while (mag->count < MAGAZINE_BATCH) {
+        uint64_t addr = buddy_alloc(0, ZONE_NORMAL);
+        if (!addr)
+            break;
+        set_cached(addr, true);
+        mag->frames[mag->count++] = addr;
+    }
+    spin_unlock(&buddyLock);
+    return mag->count;
+}
+
+// Gives the oldest count frames of a magazine back to the buddy lists.
+static void magazine_drain(struct frameMagazine *mag, uint32_t count) {
+    spin_lock(&buddyLock);
+    for (uint32_t i = 0; i < count; i++) {
+        set_cached(mag->frames[i], false);
+        buddy_free(mag->frames[i], 0);
+    }
+    spin_unlock(&buddyLock);
+    mag->count -= count;
+    memmove(mag->frames, &mag->frames[count], mag->count * sizeof(mag->frames[0]));
+}
+
+// Allocates 2^order physically contiguous frames, aligned to their own size, from the given zone
+// or, when it's exhausted, from the zones below it (which are just as reachable).
+// Returns the physical address of the first frame, or 0 if no block is big enough.
+uint64_t alloc_pages_zone(uint8_t order, uint8_t zone) {
+    if (order >= PMM_MAX_ORDER || zone >= PMM_ZONE_COUNT)
+        return 0;
+    uint64_t flags = irq_save();
+    struct frameMagazine *mag = &magazines[this_cpu()];
+    // any frame can back a normal zone request, so those are served from the magazine without a lock
+    if (order == 0 && zone == ZONE_NORMAL && (mag->count || magazine_refill(mag))) {
+        uint64_t addr = mag->frames[--mag->count];
+        set_cached(addr, false);
+        mag->allocCount++;
+        irq_restore(flags);
+        return addr;
+    }
+    spin_lock(&buddyLock);
+    uint64_t addr = buddy_alloc(order, zone);
+    spin_unlock(&buddyLock);
+    if (!addr && (mag->count || zeroedCount)) {
+        // frames parked in our magazine or the zero pool might be the ones that complete a block
+        magazine_drain(mag, mag->count);
+        spin_lock(&zeroedLock);
+        spin_lock(&buddyLock);
+        while (zeroedCount) {
+            uint64_t frame = zeroedFrames[--zeroedCount];
+            set_cached(frame, false);
+            buddy_free(frame, 0);
+        }
+        addr = buddy_alloc(order, zone);
+        spin_unlock(&buddyLock);
+        spin_unlock(&zeroedLock);
+    }
+    if (addr)
+        mag->allocCount++;
+    irq_restore(flags);
+    if (!addr)
+        printk("[PMM] alloc_pages: no free block of order %d in zone %s or below\n", order, zoneNames[zone]);
+    return addr;
+}
+
+uint64_t alloc_pages(uint8_t order) {
+    return alloc_pages_zone(order, ZONE_NORMAL);
+}
+
+// Parks a free order 0 frame in a magazine, catching what buddy_free() would: frames the PMM doesn't
+// manage, and frames that are free already. Called with interrupts off.
+static bool magazine_put(struct frameMagazine *mag, uint64_t addr) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    if (!region) {
+        printk("[PMM] free_pages: %p (order 0) is not managed by the PMM\n", (void*)addr);
+        return false;
+    }
+    struct pageFrame *meta = frame_meta(region, addr >> FRAME_SHIFT);
+    if (meta->flags & (FRAME_FREE | FRAME_CACHED)) {
+        printk("[PMM] free_pages: double free of %p\n", (void*)addr);
+        return false;
+    }
+    if (mag->count == MAGAZINE_SIZE)
+        magazine_drain(mag, MAGAZINE_BATCH);
+    meta->flags |= FRAME_CACHED;
+    mag->frames[mag->count++] = addr;
+    return true;
+}
+
+// Returns a block obtained from alloc_pages. Single frames go back to this CPU's magazine, anything bigger
+// is merged into the buddy lists straight away.
+void free_pages(uint64_t addr, uint8_t order) {
+    uint64_t flags = irq_save();
+    struct frameMagazine *mag = &magazines[this_cpu()];
+    mag->freeCount++;
+    if (order == 0) {
+        if (!magazine_put(mag, addr))
+            mag->freeCount--;
+    } else {
+        spin_lock(&buddyLock);
+        buddy_free(addr, order);
+        spin_unlock(&buddyLock);
+    }
+    irq_restore(flags);
+}
+
+// A 2 MiB aligned, 2 MiB block for map_huge().
+uint64_t alloc_huge_page(void) {
+    return alloc_pages(HUGE_PAGE_ORDER);
+}
+
+void free_huge_page(uint64_t addr) {
+    free_pages(addr, HUGE_PAGE_ORDER);
+}
+
+// Returns a single frame that is all zeroes, taking it from the pool the idle loop fills when it can.
+uint64_t alloc_zeroed_page(void) {
+    uint64_t addr = 0;
+    uint64_t flags = spin_lock_irqsave(&zeroedLock);
+    if (zeroedCount) {
+        addr = zeroedFrames[--zeroedCount];
+        set_cached(addr, false);
+        // pool frames bypass alloc_pages(), so they're counted here, on the CPU that got them
+        magazines[this_cpu()].allocCount++;
+    }
+    spin_unlock_irqrestore(&zeroedLock, flags);
+    if (addr)
+        return addr;
+    addr = alloc_pages(0);
+    if (addr)
+        simd_memset_nt((void*)(addr + kernel.hhdm), 0, FRAME_SIZE);
+    return addr;
+}
+
+// Zeroes one free frame into the pool. Called from the idle loop, with interrupts enabled, so the slow part
+// runs outside any lock. Returns false when there is nothing to do, so the caller can halt instead.
+bool pmm_zero_idle(void) {
+    if (zeroedCount >= ZERO_POOL_SIZE)
+        return false;
+    // take the frame quietly: running out of memory here isn't worth a message
+    uint64_t addr = 0;
+    uint64_t flags = irq_save();
+    struct frameMagazine *mag = &magazines[this_cpu()];
+    if (mag->count || magazine_refill(mag))
+        addr = mag->frames[--mag->count]; // still FRAME_CACHED, it only moves to the zero pool
+    irq_restore(flags);
+    if (!addr)
+        return false;
+
+    simd_memset_nt((void*)(addr + kernel.hhdm), 0, FRAME_SIZE);
+
+    flags = spin_lock_irqsave(&zeroedLock);
+    if (zeroedCount < ZERO_POOL_SIZE) {
+        zeroedFrames[zeroedCount++] = addr;
+        addr = 0;
+    }
+    spin_unlock_irqrestore(&zeroedLock, flags);
+    if (addr) {
+        // someone else filled the pool meanwhile. Taking the frame wasn't counted as an allocation, so putting
+        // it back isn't a free either
+        flags = irq_save();
+        set_cached(addr, false);
+        magazine_put(&magazines[this_cpu()], addr);
+        irq_restore(flags);
+    }
+    return true;
+}
+
+const char* pmm_zone_name(uint8_t zone) {
+    return zone < PMM_ZONE_COUNT ? zoneNames[zone] : "?";
+}
+
+// A consistent snapshot of the buddy lists. The per CPU counters are read without stopping the other CPUs,
+// so they may be a few operations behind.
+void pmm_get_stats(struct pmmStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t flags = spin_lock_irqsave(&buddyLock);
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        struct pmmZoneStats *out = &stats->zones[z];
+        out->totalFrames = zones[z].totalFrames;
+        out->reservedFrames = zones[z].reservedFrames;
+        for (int order = 0; order < PMM_MAX_ORDER; order++) {
+            out->freeBlocks[order] = zones[z].freeCount[order];
+            out->freeFrames += zones[z].freeCount[order] << order;
         }
     }
-    // if it got to this point, no memory address is avaliable.
-    printk("[PMM] kmalloc: FAILED to allocate!\n");
-    printk("KERNEL ERROR: Not enough physical memory space to allocate.\nHalting device.\n");
-    asm("cli; hlt");
-    // and make the compiler happy by returning an arbitrary value
-    return (void*) 0x00;
-}
-
-void kfree(void* location) {
-    // get the memory address to change
-    // pageFrameNumber = (location - (kernel.largestSect.maxBegin + kernel.largestSect.bitmapReserved)) / 1024
-    // bitmapMemAddress = (pageFrameNumber >> 3) + kernel.largestSect.maxBegin + kernel.hhdm
-    uint32_t pfNum = (((uint64_t)location) - (kernel.largestSect.maxBegin + kernel.largestSect.bitmapReserved)) / 4096;
-    uint64_t bitmapMemAddr = (pfNum >> 3) + kernel.largestSect.maxBegin + kernel.hhdm;
-    // now get the thing at that address, and set the right thingy to 0
-    uint8_t bitmapByte = *((uint8_t*)bitmapMemAddr);
-    // get the bit that needs to be changed
-    uint8_t bitToChange = pfNum % 8;
-    // and change it, putting the new version at the correct address
-    uint8_t newByte = setBit(bitmapByte, bitToChange, 0);
-    *((uint8_t*)bitmapMemAddr) = newByte;
-    // and it should be free'd now :D
+    spin_unlock_irqrestore(&buddyLock, flags);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->cachedFrames += magazines[cpu].count;
+        stats->allocCount += magazines[cpu].allocCount;
+        stats->freeCount += magazines[cpu].freeCount;
+    }
+    stats->cachedFrames += zeroedCount;
+}
+
+// Reference counts for frames mapped by more than one address space (copy-on-write). A frame comes out of
+// alloc_pages() with one owner and nothing to count, page_share() adds an owner, and page_release() drops one,
+// freeing the block with the last. Returns false when the count can't go any higher.
+bool page_share(uint64_t addr) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    if (!region)
+        return false;
+    struct pageFrame *meta = frame_meta(region, addr >> FRAME_SHIFT);
+    uint16_t shared = __atomic_load_n(&meta->shared, __ATOMIC_RELAXED);
+    do {
+        if (shared == UINT16_MAX)
+            return false;
+    } while (!__atomic_compare_exchange_n(&meta->shared, &shared, shared + 1, false, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+    return true;
+}
+
+void page_release(uint64_t addr, uint8_t order) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    if (region) {
+        struct pageFrame *meta = frame_meta(region, addr >> FRAME_SHIFT);
+        uint16_t shared = __atomic_load_n(&meta->shared, __ATOMIC_ACQUIRE);
+        while (shared) {
+            if (__atomic_compare_exchange_n(&meta->shared, &shared, shared - 1, false, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE))
+                return;
+        }
+    }
+    free_pages(addr, order);
+}
+
+// True while some other address space maps the frame too.
+bool page_is_shared(uint64_t addr) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    return region && __atomic_load_n(&frame_meta(region, addr >> FRAME_SHIFT)->shared, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Per frame metadata for the heap: which block a frame belongs to and what it's used for.
+// Addresses that aren't managed by the PMM read as order 0 with no flags.
+uint8_t page_order(uint64_t addr) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    return region ? frame_meta(region, addr >> FRAME_SHIFT)->order : 0;
+}
+
+uint8_t page_flags(uint64_t addr) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    return region ? frame_meta(region, addr >> FRAME_SHIFT)->flags : 0;
+}
+
+void set_page_info(uint64_t addr, uint8_t order, uint8_t flags) {
+    struct pmmRegion *region = find_region(addr >> FRAME_SHIFT);
+    if (!region)
+        return;
+    struct pageFrame *meta = frame_meta(region, addr >> FRAME_SHIFT);
+    meta->order = order;
+    meta->flags = (meta->flags & (FRAME_FREE | FRAME_CACHED)) | (flags & ~(FRAME_FREE | FRAME_CACHED));
 }
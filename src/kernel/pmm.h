@@ -2,16 +2,66 @@
  * Copyright (C) 2024 Jake Steinburger under the MIT license. See the GitHub repo for more information.
  */
 
+#include <stdbool.h>
 #include <limine.h>
 
 #ifndef PMM_H
 #define PMM_H
 
+// Blocks come in orders 0 (one 4 KiB frame) up to PMM_MAX_ORDER - 1 (4 MiB)
+#define PMM_MAX_ORDER 11
+// 512 frames: blocks are aligned to their size, so these can back a 2 MiB page directly
+#define HUGE_PAGE_ORDER 9
+
+// Physical memory zones, ordered by how far up a device can reach
+#define ZONE_DMA    0 // below 16 MiB, for legacy ISA DMA
+#define ZONE_DMA32  1 // below 4 GiB, for 32 bit bus masters such as UHCI
+#define ZONE_NORMAL 2 // everything else
+#define PMM_ZONE_COUNT 3
+
+// per frame flags, see page_flags()
+#define FRAME_FREE 0x01 // first frame of a free block sitting in a free list
+#define FRAME_SLAB 0x02 // part of a kmalloc slab, page_order() is the order of the slab
+#define FRAME_CACHED 0x04 // free order 0 frame parked in a per CPU magazine or the zero pool
+
+struct pmmZoneStats {
+    uint64_t totalFrames;    // frames handed to the allocator
+    uint64_t freeFrames;     // frames sitting in the buddy lists
+    uint64_t reservedFrames; // frames the allocator doesn't manage: firmware, bootloader, kernel, PMM metadata
+    uint64_t freeBlocks[PMM_MAX_ORDER];
+};
+
+struct pmmStats {
+    struct pmmZoneStats zones[PMM_ZONE_COUNT];
+    uint64_t cachedFrames; // free, but parked in a per CPU magazine or the zero pool
+    uint64_t allocCount;
+    uint64_t freeCount;
+};
+
 void initPMM();
+void pmm_get_stats(struct pmmStats *stats);
+const char* pmm_zone_name(uint8_t zone);
+void pmm_add_region(uint64_t base, uint64_t length);
+void pmm_reclaim(uint64_t base, uint64_t length);
+void pmm_reclaim_bootloader(uint64_t keep);
 
-void* kmalloc();
-void* map_at_addr(uint64_t addr, uint64_t size);
+uint64_t alloc_pages(uint8_t order);
+uint64_t alloc_pages_zone(uint8_t order, uint8_t zone);
+void free_pages(uint64_t addr, uint8_t order);
+
+uint64_t alloc_huge_page(void);
+void free_huge_page(uint64_t addr);
+uint64_t alloc_zeroed_page(void);
+bool pmm_zero_idle(void);
+
+bool page_share(uint64_t addr);
+void page_release(uint64_t addr, uint8_t order);
+bool page_is_shared(uint64_t addr);
 
-void kfree(void* location);
+uint8_t page_order(uint64_t addr);
+uint8_t page_flags(uint64_t addr);
+void set_page_info(uint64_t addr, uint8_t order, uint8_t flags);
+
+void* map_at_addr(uint64_t addr, uint64_t size);
 
 #endif
@@ -0,0 +1,117 @@
+/* Fixed size object pools.
+ * A pool carves whole frames into objects of one size and alignment, runs the constructor on each object once,
+ * and keeps the ones not in use on a free list. Getting and putting an object back is then a couple of pointer
+ * moves, and it comes back already constructed. The free list link lives just past each object rather than
+ * inside it, so it doesn't clobber what the constructor set up.
+ * Pools only grow: their frames stay with the pool for reuse.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <kernel/kernel.h>
+#include <kernel/printk.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/spinlock.h>
+#include <kernel/pool.h>
+
+#define POOL_PAGE_SIZE 4096
+
+struct objectPool {
+    size_t objectSize;
+    size_t stride;    // object + free list link, rounded up to the alignment
+    pool_ctor_t ctor;
+    uint8_t zone;
+    void *freeList;
+    spinlock_t lock;
+};
+
+static inline void** free_link(struct objectPool *pool, void *object) {
+    return (void**)((uint8_t*)object + pool->objectSize);
+}
+
+struct objectPool* pool_create_zone(size_t objectSize, size_t align, pool_ctor_t ctor, uint8_t zone) {
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+    if (objectSize == 0 || (align & (align - 1)) != 0 || align > POOL_PAGE_SIZE) {
+        printk("[POOL] pool_create: bad object size %d or alignment %d\n", objectSize, align);
+        return NULL;
+    }
+    // the link after the object has to be pointer aligned too
+    size_t linkOffset = (objectSize + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    size_t stride = (linkOffset + sizeof(void*) + align - 1) & ~(align - 1);
+    if (stride > POOL_PAGE_SIZE) {
+        printk("[POOL] pool_create: objects of %d bytes don't fit in a page\n", objectSize);
+        return NULL;
+    }
+    struct objectPool *pool = kmalloc(sizeof(struct objectPool));
+    if (!pool)
+        return NULL;
+    pool->objectSize = linkOffset;
+    pool->stride = stride;
+    pool->ctor = ctor;
+    pool->zone = zone;
+    pool->freeList = NULL;
+    pool->lock = (spinlock_t)SPINLOCK_INIT;
+    return pool;
+}
+
+struct objectPool* pool_create(size_t objectSize, size_t align, pool_ctor_t ctor) {
+    return pool_create_zone(objectSize, align, ctor, ZONE_NORMAL);
+}
+
+// Carves a new frame into constructed objects. Called without the lock, the constructors may be slow.
+static bool pool_grow(struct objectPool *pool) {
+    uint64_t phys = alloc_pages_zone(0, pool->zone);
+    if (!phys)
+        return false;
+    uint8_t *page = (uint8_t*)(phys + kernel.hhdm);
+    void *first = NULL;
+    void *last = NULL;
+    for (size_t offset = 0; offset + pool->stride <= POOL_PAGE_SIZE; offset += pool->stride) {
+        void *object = page + offset;
+        if (pool->ctor)
+            pool->ctor(object);
+        *free_link(pool, object) = NULL;
+        if (last)
+            *free_link(pool, last) = object;
+        else
+            first = object;
+        last = object;
+    }
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    *free_link(pool, last) = pool->freeList;
+    pool->freeList = first;
+    spin_unlock_irqrestore(&pool->lock, flags);
+    return true;
+}
+
+// Returns a constructed object, or NULL if the pool is empty and no frame could be added.
+void* pool_get(struct objectPool *pool) {
+    while (1) {
+        uint64_t flags = spin_lock_irqsave(&pool->lock);
+        void *object = pool->freeList;
+        if (object)
+            pool->freeList = *free_link(pool, object);
+        spin_unlock_irqrestore(&pool->lock, flags);
+        if (object)
+            return object;
+        if (!pool_grow(pool))
+            return NULL;
+    }
+}
+
+void pool_put(struct objectPool *pool, void *object) {
+    if (!object)
+        return;
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    *free_link(pool, object) = pool->freeList;
+    pool->freeList = object;
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+// Objects live in the HHDM, so this is the address a device has to be given to DMA to one.
+uint64_t pool_phys(const void *object) {
+    return (uint64_t)object - kernel.hhdm;
+}
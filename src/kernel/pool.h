@@ -0,0 +1,23 @@
+/* Header for ../pool.c, fixed size object pools.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef POOL_H
+#define POOL_H
+
+struct objectPool;
+
+// ctor runs once per object, when its page is added to the pool. pool_put() takes objects back in
+// constructed state, so users must leave them that way (or only touch fields they set on every pool_get()).
+typedef void (*pool_ctor_t)(void *object);
+
+struct objectPool* pool_create(size_t objectSize, size_t align, pool_ctor_t ctor);
+struct objectPool* pool_create_zone(size_t objectSize, size_t align, pool_ctor_t ctor, uint8_t zone);
+void* pool_get(struct objectPool *pool);
+void pool_put(struct objectPool *pool, void *object);
+
+uint64_t pool_phys(const void *object);
+
+#endif
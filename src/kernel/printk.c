@@ -3,30 +3,39 @@
 #include <drivers/serial.h>
 #include <kernel/util/hexdump.h>
 
+// printk runs in interrupt handlers too, so the serial copy is streamed a character at a time
+// instead of being formatted into a buffer first
+static void serial_out(char character, void* arg) {
+        (void)arg;
+        if (character == '\n')
+                outCharSerial('\r');
+        outCharSerial(character);
+}
+
 int printk(const char* format, ...) {
-        va_list args;
+        va_list args, serial_args;
         va_start(args, format);
+        va_copy(serial_args, args);
         int ret = vprintf(format,args);
-        va_end(args);
         if (kernel.serial_output) {
-            char buffer[1024];
-            snprintf(buffer,sizeof(buffer),format,args);
-            writeserial(buffer);
-        } 
+            vfctprintf(serial_out, NULL, format, serial_args);
+        }
+        va_end(serial_args);
+        va_end(args);
         return ret;
 }
 
 int kdebug(const char* format, ...) {
     if (kernel.debug) {
-        va_list args;
+        va_list args, serial_args;
         va_start(args, format);
+        va_copy(serial_args, args);
         int ret = vprintf(format,args);
-        va_end(args);
         if (kernel.serial_output) {
-            char buffer[1024];
-            snprintf(buffer,sizeof(buffer),format,args);
-            writeserial(buffer);
+            vfctprintf(serial_out, NULL, format, serial_args);
         }
+        va_end(serial_args);
+        va_end(args);
         return ret;
    } else {
         return 0;
@@ -3,6 +3,9 @@
 #include <stdlib/string.h>
 #include <kernel/printk.h>
 #include <kernel/kernel.h>
+#include <kernel/slab.h>
+#include <kernel/arena.h>
+#include <kernel/bench.h>
 #include <kernel/pmm.h>
 #include <kernel/mem.h>
 #include <limine.h>
@@ -42,7 +45,43 @@ void show_info() {
     printk("\n");
 }
 
-bool process_command(char *input) {
+void show_meminfo() {
+    struct pmmStats pmm;
+    struct kmallocStats heap;
+    pmm_get_stats(&pmm);
+    kmalloc_get_stats(&heap);
+
+    printk("\nZone      Total KB    Free KB     Reserved KB\n");
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        printk("%-8s  %-10zu  %-10zu  %zu\n", pmm_zone_name(z), pmm.zones[z].totalFrames * 4,
+               pmm.zones[z].freeFrames * 4, pmm.zones[z].reservedFrames * 4);
+    }
+    printk("Cached    %zu KB (per CPU magazines and zeroed pages)\n", pmm.cachedFrames * 4);
+
+    // a zone with plenty of free frames but nothing at the higher orders is fragmented
+    printk("\nFree blocks per order (4KB << order)\n");
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        printk("%-8s ", pmm_zone_name(z));
+        for (int order = 0; order < PMM_MAX_ORDER; order++)
+            printk(" %zu", pmm.zones[z].freeBlocks[order]);
+        printk("\n");
+    }
+
+    printk("\nPages    %zu allocations, %zu frees\n", pmm.allocCount, pmm.freeCount);
+    printk("kmalloc  %zu allocations, %zu frees, %zu failures\n", heap.allocCount, heap.freeCount, heap.failCount);
+    printk("kmalloc latency (TSC cycles):\n");
+    for (int bucket = 0; bucket < KMALLOC_LATENCY_BUCKETS; bucket++) {
+        if (heap.latency[bucket])
+            printk("  >= %-10zu %zu\n", (uint64_t)1 << bucket, heap.latency[bucket]);
+    }
+    printk("\n");
+}
+
+// Scratch memory for the command being run, dropped in one go once it returns.
+// All zeroes is the same as arena_begin().
+static struct arena command_arena = {0};
+
+static bool run_command(char *input) {
        // printk("command %s",input);
         if (strcmp(input,"panic")){
                 asm("int $0x03"); // debug isr
@@ -55,9 +94,10 @@ bool process_command(char *input) {
                 return false;
             }
             uint8_t code[] = {0xcd,0x80,0xc3};
-            memcpy(ptr + kernel.hhdm, code, sizeof(code));
-            int (*elf_entry_point)(void) = (int(*)(void))(ptr + kernel.hhdm);
+            memcpy(ptr, code, sizeof(code));
+            int (*elf_entry_point)(void) = (int(*)(void))ptr;
             elf_entry_point();
+            kfree(ptr);
         } else if (strcmp(input,"serial")) {
                 if (kernel.serial_output) {
                         kernel.serial_output = false;
@@ -77,12 +117,15 @@ bool process_command(char *input) {
         } else if (strcmp(input,"lspci")) {
                 pci_init();
         } else if (strcmp(input,"exec")) {
-                //uint8_t* buffer[4608] = {0};
-                uint8_t buffer[4608] = {0};
                 printk("Reading executable from disk\n");
-                read_file("HELLO", buffer,4608);
-                hexdump(buffer,4608);
-                read_elf(buffer, true);
+                uint32_t size = 0;
+                uint8_t* buffer = load_file_arena(&command_arena, "HELLO", &size);
+                if (!buffer) {
+                    printk("ERROR: could not load HELLO\n");
+                    return false;
+                }
+                hexdump(buffer,size);
+                read_elf(buffer, size, true);
         } else if (strcmp(input,"reboot")) {
             // zeroing IDT and calling a non-defined interrupt
             uint64_t zero = 0;
@@ -99,14 +142,25 @@ bool process_command(char *input) {
                 return false;
             }
             char buf[17];
-            uint64_to_hex_string((uint64_t)(ptr + kernel.hhdm), buf);
+            uint64_to_hex_string((uint64_t)ptr, buf);
             printk("\n8192 byte block dynamically allocated by the kernel: address 0x%s\n", buf);
+            kfree(ptr);
+        } else if (strcmp(input,"meminfo")) {
+            show_meminfo();
+        } else if (strncmp(input,"bench",5) == 0 && (input[5] == '\0' || input[5] == ' ')) {
+            char *name = input[5] ? input + 6 : NULL;
+            if (!bench_run(name)) {
+                printk("ERROR: no benchmark called %s, there are:", name);
+                bench_list();
+            }
         } else if (strcmp(input,"help")) {
                 printk("\nCommands available:\n");
                 printk(" - help       Shows this help menu\n");
                 printk(" - panic      Force a kernel panic\n");
                 printk(" - info       Shows some system info\n");
                 printk(" - kmalloc    Tests kmalloc kernel function\n");
+                printk(" - meminfo    Shows free memory, fragmentation and allocator statistics\n");
+                printk(" - bench      Runs the microbenchmarks, or just one with bench <name>\n");
                 printk(" - fat        Prints FAT32 EBPB from IDE2\n");
                 printk(" - reboot     Reboot machine\n");
                 printk(" - exec       Exec ELF executable reading from IDE2 FAT32\n");
@@ -127,3 +181,9 @@ bool process_command(char *input) {
         }
         return false;
 }
+
+bool process_command(char *input) {
+        bool exit = run_command(input);
+        arena_reset(&command_arena);
+        return exit;
+}
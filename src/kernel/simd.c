@@ -0,0 +1,72 @@
+/* Entry points for the vector kernels: pick AVX2 or SSE2 and bracket the call with the FPU guard.
+ * Saving and restoring the vector state costs a few hundred cycles, so small buffers go to the plain
+ * mem* functions instead.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/mem.h>
+#include <kernel/fpu.h>
+#include <kernel/simd.h>
+
+#define SIMD_THRESHOLD 1024
+
+void *simd_memcpy(void *dest, const void *src, size_t n) {
+    if (n < SIMD_THRESHOLD || !fpu_has_sse2())
+        return memcpy(dest, src, n);
+    kernel_fpu_begin();
+    if (fpu_has_avx2())
+        memcpy_avx2(dest, src, n);
+    else
+        memcpy_sse2(dest, src, n);
+    kernel_fpu_end();
+    return dest;
+}
+
+void *simd_memset(void *s, int c, size_t n) {
+    if (n < SIMD_THRESHOLD || !fpu_has_sse2())
+        return memset(s, c, n);
+    kernel_fpu_begin();
+    if (fpu_has_avx2())
+        memset_avx2(s, (uint8_t)c, n);
+    else
+        memset_sse2(s, (uint8_t)c, n);
+    kernel_fpu_end();
+    return s;
+}
+
+void *simd_memset_nt(void *s, int c, size_t n) {
+    if (n < SIMD_THRESHOLD || !fpu_has_sse2())
+        return memset_nt(s, c, n);
+    kernel_fpu_begin();
+    if (fpu_has_avx2())
+        memset_nt_avx2(s, (uint8_t)c, n);
+    else
+        memset_nt_sse2(s, (uint8_t)c, n);
+    kernel_fpu_end();
+    asm volatile ("sfence" : : : "memory");
+    return s;
+}
+
+int simd_memcmp(const void *s1, const void *s2, size_t n) {
+    if (n < SIMD_THRESHOLD || !fpu_has_sse2())
+        return memcmp(s1, s2, n);
+    kernel_fpu_begin();
+    int result = fpu_has_avx2() ? memcmp_avx2(s1, s2, n) : memcmp_sse2(s1, s2, n);
+    kernel_fpu_end();
+    return result;
+}
+
+uint32_t simd_checksum32(const void *buf, size_t n) {
+    if (!fpu_has_sse2()) {
+        const uint8_t *p = (const uint8_t *)buf;
+        uint32_t total = 0;
+        for (size_t i = 0; i < n; i++)
+            total += (uint32_t)p[i] << (8 * (i & 3));
+        return total;
+    }
+    kernel_fpu_begin();
+    uint32_t result = fpu_has_avx2() ? checksum32_avx2(buf, n) : checksum32_sse2(buf, n);
+    kernel_fpu_end();
+    return result;
+}
@@ -0,0 +1,33 @@
+/* Header for ../simd.c, vectorised bulk memory operations.
+ * The simd_* functions pick the widest kernel the CPU runs (AVX2, then SSE2), wrap it in
+ * kernel_fpu_begin()/kernel_fpu_end() and fall back to the plain mem* functions for small sizes or without SSE.
+ * Worth it for page sized and larger buffers, not for anything a few cache lines long.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SIMD_H
+#define SIMD_H
+
+void *simd_memcpy(void *dest, const void *src, size_t n);
+void *simd_memset(void *s, int c, size_t n);
+int simd_memcmp(const void *s1, const void *s2, size_t n);
+// non-temporal, movntdq instead of the movnti of memset_nt(), for frames that won't be read back soon
+void *simd_memset_nt(void *s, int c, size_t n);
+// sum of the little endian 32 bit words in buf, modulo 2^32, with a partial last word padded with zeroes
+uint32_t simd_checksum32(const void *buf, size_t n);
+
+// the per instruction set kernels, only valid inside a kernel_fpu_begin() section
+void memcpy_sse2(void *dest, const void *src, size_t n);
+void memset_sse2(void *s, uint8_t c, size_t n);
+int memcmp_sse2(const void *s1, const void *s2, size_t n);
+uint32_t checksum32_sse2(const void *buf, size_t n);
+void memset_nt_sse2(void *s, uint8_t c, size_t n);
+void memcpy_avx2(void *dest, const void *src, size_t n);
+void memset_avx2(void *s, uint8_t c, size_t n);
+int memcmp_avx2(const void *s1, const void *s2, size_t n);
+uint32_t checksum32_avx2(const void *buf, size_t n);
+void memset_nt_avx2(void *s, uint8_t c, size_t n);
+
+#endif
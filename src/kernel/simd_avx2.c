@@ -0,0 +1,8 @@
+/* AVX2 build of the vector kernels in simd_template.h, compiled with -mavx2 (see GNUmakefile).
+ */
+
+#define SIMD_WIDTH 32
+#define SIMD_NAME(x) x##_avx2
+typedef long long simd_v4di __attribute__((vector_size(32)));
+#define SIMD_STREAM(p, v) __builtin_ia32_movntdq256((simd_v4di *)(p), (simd_v4di)(v))
+#include <kernel/simd_template.h>
@@ -0,0 +1,8 @@
+/* SSE2 build of the vector kernels in simd_template.h, compiled with -msse2 (see GNUmakefile).
+ */
+
+#define SIMD_WIDTH 16
+#define SIMD_NAME(x) x##_sse2
+typedef long long simd_v2di __attribute__((vector_size(16)));
+#define SIMD_STREAM(p, v) __builtin_ia32_movntdq((simd_v2di *)(p), (simd_v2di)(v))
+#include <kernel/simd_template.h>
@@ -0,0 +1,111 @@
+/* Body of the vector kernels, included by simd_sse2.c and simd_avx2.c with SIMD_WIDTH (vector size in bytes)
+ * SIMD_NAME(x) (suffixing x) and SIMD_STREAM(p, v) (a non-temporal store of v to aligned p) defined. Written with GCC vector extensions, so the compiler picks the
+ * instructions for whatever -m flags the including file is built with.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/simd.h>
+
+typedef uint8_t vec_u8 __attribute__((vector_size(SIMD_WIDTH)));
+typedef uint32_t vec_u32 __attribute__((vector_size(SIMD_WIDTH)));
+typedef uint64_t vec_u64 __attribute__((vector_size(SIMD_WIDTH)));
+// the same, for loads and stores at any alignment
+typedef uint8_t vec_u8_unaligned __attribute__((vector_size(SIMD_WIDTH), aligned(1), may_alias));
+typedef uint32_t vec_u32_unaligned __attribute__((vector_size(SIMD_WIDTH), aligned(1), may_alias));
+typedef uint32_t u32_unaligned __attribute__((aligned(1), may_alias));
+
+#define SIMD_LANES64 (SIMD_WIDTH / 8)
+#define SIMD_LANES32 (SIMD_WIDTH / 4)
+
+void SIMD_NAME(memcpy)(void *dest, const void *src, size_t n) {
+    uint8_t *pdest = (uint8_t *)dest;
+    const uint8_t *psrc = (const uint8_t *)src;
+    // four vectors per round keeps enough loads in flight
+    for (; n >= 4 * SIMD_WIDTH; n -= 4 * SIMD_WIDTH, pdest += 4 * SIMD_WIDTH, psrc += 4 * SIMD_WIDTH) {
+        vec_u8 a = *(const vec_u8_unaligned *)psrc;
+        vec_u8 b = *(const vec_u8_unaligned *)(psrc + SIMD_WIDTH);
+        vec_u8 c = *(const vec_u8_unaligned *)(psrc + 2 * SIMD_WIDTH);
+        vec_u8 d = *(const vec_u8_unaligned *)(psrc + 3 * SIMD_WIDTH);
+        *(vec_u8_unaligned *)pdest = a;
+        *(vec_u8_unaligned *)(pdest + SIMD_WIDTH) = b;
+        *(vec_u8_unaligned *)(pdest + 2 * SIMD_WIDTH) = c;
+        *(vec_u8_unaligned *)(pdest + 3 * SIMD_WIDTH) = d;
+    }
+    for (; n >= SIMD_WIDTH; n -= SIMD_WIDTH, pdest += SIMD_WIDTH, psrc += SIMD_WIDTH)
+        *(vec_u8_unaligned *)pdest = *(const vec_u8_unaligned *)psrc;
+    while (n--)
+        *pdest++ = *psrc++;
+}
+
+void SIMD_NAME(memset)(void *s, uint8_t c, size_t n) {
+    uint8_t *p = (uint8_t *)s;
+    vec_u8 fill = (vec_u8){0} + c;
+    for (; n >= 4 * SIMD_WIDTH; n -= 4 * SIMD_WIDTH, p += 4 * SIMD_WIDTH) {
+        *(vec_u8_unaligned *)p = fill;
+        *(vec_u8_unaligned *)(p + SIMD_WIDTH) = fill;
+        *(vec_u8_unaligned *)(p + 2 * SIMD_WIDTH) = fill;
+        *(vec_u8_unaligned *)(p + 3 * SIMD_WIDTH) = fill;
+    }
+    for (; n >= SIMD_WIDTH; n -= SIMD_WIDTH, p += SIMD_WIDTH)
+        *(vec_u8_unaligned *)p = fill;
+    while (n--)
+        *p++ = c;
+}
+
+// Bytes up to the first SIMD_WIDTH boundary of dest, so the streaming stores are aligned.
+static inline size_t SIMD_NAME(head)(const void *dest, size_t n) {
+    size_t head = (SIMD_WIDTH - ((uintptr_t)dest & (SIMD_WIDTH - 1))) & (SIMD_WIDTH - 1);
+    return head < n ? head : n;
+}
+
+// The _nt kernel leaves the sfence to the caller.
+void SIMD_NAME(memset_nt)(void *s, uint8_t c, size_t n) {
+    uint8_t *p = (uint8_t *)s;
+    vec_u8 fill = (vec_u8){0} + c;
+    for (size_t head = SIMD_NAME(head)(p, n); head; head--, n--)
+        *p++ = c;
+    for (; n >= SIMD_WIDTH; n -= SIMD_WIDTH, p += SIMD_WIDTH)
+        SIMD_STREAM(p, fill);
+    while (n--)
+        *p++ = c;
+}
+
+int SIMD_NAME(memcmp)(const void *s1, const void *s2, size_t n) {
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+    // whole vectors are only checked for equality, the byte loop below finds the order inside the first
+    // one that differs
+    for (; n >= SIMD_WIDTH; n -= SIMD_WIDTH, p1 += SIMD_WIDTH, p2 += SIMD_WIDTH) {
+        vec_u64 a = (vec_u64)*(const vec_u8_unaligned *)p1;
+        vec_u64 b = (vec_u64)*(const vec_u8_unaligned *)p2;
+        vec_u64 diff = a ^ b;
+        uint64_t any = 0;
+        for (int lane = 0; lane < SIMD_LANES64; lane++)
+            any |= diff[lane];
+        if (any)
+            break;
+    }
+    for (; n; n--, p1++, p2++) {
+        if (*p1 != *p2)
+            return *p1 < *p2 ? -1 : 1;
+    }
+    return 0;
+}
+
+uint32_t SIMD_NAME(checksum32)(const void *buf, size_t n) {
+    const uint8_t *p = (const uint8_t *)buf;
+    vec_u32 sum = {0};
+    for (; n >= SIMD_WIDTH; n -= SIMD_WIDTH, p += SIMD_WIDTH)
+        sum += *(const vec_u32_unaligned *)p;
+    uint32_t total = 0;
+    for (int lane = 0; lane < SIMD_LANES32; lane++)
+        total += sum[lane];
+    for (; n >= 4; n -= 4, p += 4)
+        total += *(const u32_unaligned *)p;
+    // the zero padded last word
+    uint32_t last = 0;
+    for (size_t i = 0; i < n; i++)
+        last |= (uint32_t)p[i] << (8 * i);
+    return total + last;
+}
@@ -0,0 +1,215 @@
+/* Size class (slab) heap behind kmalloc/kfree.
+ *
+ * Requests up to 2 KiB are rounded up to a power of two size class. Each class has a cache of slabs: naturally
+ * aligned buddy blocks with a small header in their first cache line followed by equally sized objects, threaded
+ * on a per-slab free list. Bigger requests fall through to the page allocator.
+ * Each cache has a lock, taken with interrupts off since interrupt handlers allocate too. Slabs are made and
+ * given back to the PMM outside it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/kernel.h>
+#include <kernel/printk.h>
+#include <kernel/pmm.h>
+#include <kernel/mem.h>
+#include <kernel/timer.h>
+#include <kernel/spinlock.h>
+#include <kernel/slab.h>
+
+#define SLAB_PAGE_SIZE 4096
+#define SLAB_CACHE_LINE 64
+// objects start one cache line into the slab, so every class >= 64 bytes is cache line aligned
+#define SLAB_HEADER_SIZE SLAB_CACHE_LINE
+
+struct slab {
+    struct kmemCache *cache;
+    struct slab *next; // links slabs that still have free objects
+    struct slab *prev;
+    void *freeList;    // free objects are chained through their first 8 bytes
+    uint16_t inUse;
+};
+
+struct kmemCache {
+    spinlock_t lock; // protects partial, emptySlabs and the free lists and counts of the cache's slabs
+    uint32_t objectSize;
+    uint8_t slabOrder;
+    uint16_t objectsPerSlab;
+    struct slab *partial; // slabs with at least one free object, including empty ones
+    uint32_t emptySlabs;  // empty slabs on the partial list, one is kept to avoid PMM round trips
+};
+
+_Static_assert(sizeof(struct slab) <= SLAB_HEADER_SIZE, "slab header must fit in its cache line");
+
+// bigger classes get bigger slabs, so no more than ~1/16th of a slab is lost to the header and tail
+static struct kmemCache caches[] = {
+    { .lock = SPINLOCK_INIT, .objectSize = 16,   .slabOrder = 0 },
+    { .lock = SPINLOCK_INIT, .objectSize = 32,   .slabOrder = 0 },
+    { .lock = SPINLOCK_INIT, .objectSize = 64,   .slabOrder = 0 },
+    { .lock = SPINLOCK_INIT, .objectSize = 128,  .slabOrder = 0 },
+    { .lock = SPINLOCK_INIT, .objectSize = 256,  .slabOrder = 0 },
+    { .lock = SPINLOCK_INIT, .objectSize = 512,  .slabOrder = 1 },
+    { .lock = SPINLOCK_INIT, .objectSize = 1024, .slabOrder = 2 },
+    { .lock = SPINLOCK_INIT, .objectSize = 2048, .slabOrder = 3 },
+};
+
+#define SLAB_CACHE_COUNT (sizeof(caches) / sizeof(caches[0]))
+#define SLAB_MAX_SIZE 2048
+
+static struct kmallocStats stats = {0};
+
+static struct kmemCache* cache_for_size(size_t size) {
+    for (size_t i = 0; i < SLAB_CACHE_COUNT; i++) {
+        if (size <= caches[i].objectSize)
+            return &caches[i];
+    }
+    return NULL;
+}
+
+static void partial_push(struct kmemCache *cache, struct slab *slab) {
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (slab->next)
+        slab->next->prev = slab;
+    cache->partial = slab;
+}
+
+static void partial_remove(struct kmemCache *cache, struct slab *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        cache->partial = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+static struct slab* slab_create(struct kmemCache *cache) {
+    uint64_t phys = alloc_pages(cache->slabOrder);
+    if (!phys)
+        return NULL;
+    uint64_t slabBytes = (uint64_t)SLAB_PAGE_SIZE << cache->slabOrder;
+    if (!cache->objectsPerSlab)
+        cache->objectsPerSlab = (slabBytes - SLAB_HEADER_SIZE) / cache->objectSize;
+    // every frame of the slab points back at the slab header, which sits at the naturally aligned start
+    for (uint64_t offset = 0; offset < slabBytes; offset += SLAB_PAGE_SIZE)
+        set_page_info(phys + offset, cache->slabOrder, FRAME_SLAB);
+
+    struct slab *slab = (struct slab*)(phys + kernel.hhdm);
+    slab->cache = cache;
+    slab->inUse = 0;
+    slab->freeList = NULL;
+    // thread the objects back to front so the free list hands them out in address order
+    uint8_t *objects = (uint8_t*)slab + SLAB_HEADER_SIZE;
+    for (int i = cache->objectsPerSlab - 1; i >= 0; i--) {
+        void **object = (void**)(objects + (uint64_t)i * cache->objectSize);
+        *object = slab->freeList;
+        slab->freeList = object;
+    }
+    return slab;
+}
+
+// Gives a slab that is off the partial list back to the PMM. Called without the cache lock.
+static void slab_destroy(struct kmemCache *cache, struct slab *slab) {
+    uint64_t phys = (uint64_t)slab - kernel.hhdm;
+    uint64_t slabBytes = (uint64_t)SLAB_PAGE_SIZE << cache->slabOrder;
+    for (uint64_t offset = 0; offset < slabBytes; offset += SLAB_PAGE_SIZE)
+        set_page_info(phys + offset, 0, 0);
+    free_pages(phys, cache->slabOrder);
+}
+
+static void* cache_alloc(struct kmemCache *cache) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    while (!cache->partial) {
+        // another CPU or an interrupt may add a slab meanwhile, then this one joins it on the list
+        spin_unlock_irqrestore(&cache->lock, flags);
+        struct slab *fresh = slab_create(cache);
+        if (!fresh)
+            return NULL;
+        flags = spin_lock_irqsave(&cache->lock);
+        partial_push(cache, fresh);
+        cache->emptySlabs++;
+    }
+    struct slab *slab = cache->partial;
+    void **object = slab->freeList;
+    slab->freeList = *object;
+    if (slab->inUse++ == 0)
+        cache->emptySlabs--;
+    if (!slab->freeList)
+        partial_remove(cache, slab);
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return object;
+}
+
+static void cache_free(struct slab *slab, void *ptr) {
+    struct kmemCache *cache = slab->cache;
+    void **object = ptr;
+    struct slab *release = NULL;
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    if (!slab->freeList)
+        partial_push(cache, slab); // it was full, now it has room again
+    *object = slab->freeList;
+    slab->freeList = object;
+    if (--slab->inUse == 0) {
+        cache->emptySlabs++;
+        if (cache->emptySlabs > 1) {
+            partial_remove(cache, slab);
+            cache->emptySlabs--;
+            release = slab;
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+    if (release)
+        slab_destroy(cache, release);
+}
+
+static void* kmalloc_uncounted(size_t size) {
+    if (size == 0)
+        return NULL;
+    if (size <= SLAB_MAX_SIZE)
+        return cache_alloc(cache_for_size(size));
+    // large allocations are whole buddy blocks
+    uint8_t order = 0;
+    while (((uint64_t)SLAB_PAGE_SIZE << order) < size)
+        order++;
+    if (order >= PMM_MAX_ORDER) {
+        printk("[SLAB] kmalloc: %d bytes is more than the page allocator can hand out\n", size);
+        return NULL;
+    }
+    uint64_t phys = alloc_pages(order);
+    if (!phys)
+        return NULL;
+    return (void*)(phys + kernel.hhdm);
+}
+
+// Returns an HHDM pointer to at least size bytes, or NULL.
+void* kmalloc(size_t size) {
+    uint64_t start = rdtsc();
+    void *ptr = kmalloc_uncounted(size);
+    uint64_t cycles = rdtsc() - start;
+
+    int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    if (bucket >= KMALLOC_LATENCY_BUCKETS)
+        bucket = KMALLOC_LATENCY_BUCKETS - 1;
+    // the counters are only statistics, they're bumped atomically rather than under a lock
+    __atomic_fetch_add(&stats.latency[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(ptr ? &stats.allocCount : &stats.failCount, 1, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    if (!ptr)
+        return;
+    __atomic_fetch_add(&stats.freeCount, 1, __ATOMIC_RELAXED);
+    uint64_t phys = (uint64_t)ptr - kernel.hhdm;
+    uint8_t order = page_order(phys);
+    if (page_flags(phys) & FRAME_SLAB) {
+        uint64_t slabBytes = (uint64_t)SLAB_PAGE_SIZE << order;
+        cache_free((struct slab*)((phys & ~(slabBytes - 1)) + kernel.hhdm), ptr);
+    } else {
+        free_pages(phys, order);
+    }
+}
+
+void kmalloc_get_stats(struct kmallocStats *out) {
+    memcpy(out, &stats, sizeof(stats));
+}
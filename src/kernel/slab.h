@@ -0,0 +1,25 @@
+/* Header for ../slab.c, the kernel heap.
+ */
+
+#include <stddef.h>
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+
+// kmalloc latency histogram: bucket n counts calls that took [2^n, 2^(n+1)) TSC cycles, the last one everything slower
+#define KMALLOC_LATENCY_BUCKETS 24
+
+struct kmallocStats {
+    uint64_t allocCount;
+    uint64_t freeCount;
+    uint64_t failCount;
+    uint64_t latency[KMALLOC_LATENCY_BUCKETS];
+};
+
+void* kmalloc(size_t size);
+void kfree(void* ptr);
+void kmalloc_get_stats(struct kmallocStats *stats);
+
+#endif
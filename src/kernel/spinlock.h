@@ -0,0 +1,41 @@
+/* Test and test-and-set spinlock.
+ * The _irqsave variants also disable interrupts on the local CPU, which is needed for any lock that an
+ * interrupt handler might take, or the handler would spin forever on a lock its own CPU holds.
+ */
+
+#include <stdint.h>
+#include <kernel/cpu.h>
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t *lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        // wait on a plain read so the cache line stays shared until the owner lets go
+        while (lock->locked)
+            asm volatile("pause");
+    }
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <kernel/io.h>
 #include <kernel/printk.h>
+#include <kernel/init.h>
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -10,15 +11,16 @@
 uint64_t cpu_hz;   // clock ticks per second
 
 // read the Time Stamp Count
+// ("=A" only means edx:eax in 32 bit code, in long mode it would just be rax and lose the high half)
 uint64_t rdtsc() {
-  uint64_t val; 
-  __asm__ __volatile__ ("rdtsc" : "=A" (val)); 
-  return val; 
+  uint32_t lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
 }
 
 // Check to see if the processor has the RDTSC instruction.
 // This assumes the processor has the CPUID instruction.
-bool setup_timer() {
+__init bool setup_timer() {
   
   uint32_t eax, edx;
   uint64_t start, end;
@@ -3,6 +3,7 @@
 
 
 bool setup_timer();
+uint64_t rdtsc();
 
 void ndelay(const uint32_t n);
 void udelay(const uint32_t u);
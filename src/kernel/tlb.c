@@ -0,0 +1,194 @@
+/* TLB management: global kernel pages, PCIDs and the flush helpers paging uses.
+ * tlb_init() turns on CR4.PGE and, when the CPU has them, CR4.PCIDE and INVPCID. PCIDs are handed out in
+ * order from 1. When all 4095 are taken the generation moves on, every non-global entry is flushed once, and
+ * each context picks up a fresh PCID the next time it is switched to, so a recycled PCID never finds entries
+ * that belonged to its previous owner.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/printk.h>
+#include <kernel/cpu.h>
+#include <kernel/spinlock.h>
+#include <kernel/init.h>
+#include <kernel/paging.h>
+#include <kernel/tlb.h>
+
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+
+#define CPUID_1_EDX_PGE (1 << 13)
+#define CPUID_1_ECX_PCID (1 << 17)
+#define CPUID_7_EBX_INVPCID (1 << 10)
+
+// bit 63 of a CR3 write with PCIDE on keeps the TLB entries already tagged with the new PCID
+#define CR3_NOFLUSH (1ULL << 63)
+#define PCID_COUNT 4096
+
+#define INVPCID_ADDRESS 0    // one address in one PCID
+#define INVPCID_CONTEXT 1    // everything non-global in one PCID
+#define INVPCID_ALL_GLOBAL 2 // everything, global entries included
+#define INVPCID_ALL 3        // everything except global entries
+
+// Up to this many pages a range is flushed with one invlpg per page, past it dropping everything and letting
+// the TLB refill is cheaper than the string of invlpgs.
+#define INVLPG_MAX_PAGES 32
+
+static bool hasPge = false;
+static bool hasPcid = false;
+static bool hasInvpcid = false;
+
+static spinlock_t pcidLock = SPINLOCK_INIT;
+static uint64_t pcidGeneration = 1;
+static uint16_t nextPcid = 1;
+// what each CPU has loaded in CR3, NULL until the first tlb_switch()
+static struct tlbContext *currentContext[MAX_CPUS];
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint64_t cr4) {
+    asm volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t virt_addr) {
+    struct {
+        uint64_t pcid;
+        uint64_t address;
+    } descriptor = { pcid, virt_addr };
+    asm volatile ("invpcid %0, %1" :: "m"(descriptor), "r"(type) : "memory");
+}
+
+// Writing CR3 back drops the non-global entries of the current PCID
+static inline void reload_cr3(void) {
+    uint64_t cr3;
+    asm volatile ("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3) :: "memory");
+}
+
+__init void tlb_init() {
+    uint32_t eax, ebx, ecx, edx, maxLeaf;
+    cpuid(0, 0, &maxLeaf, &ebx, &ecx, &edx);
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    hasPge = edx & CPUID_1_EDX_PGE;
+    bool pcid = ecx & CPUID_1_ECX_PCID;
+    if (maxLeaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        hasInvpcid = ebx & CPUID_7_EBX_INVPCID;
+    }
+
+    uint64_t cr3;
+    asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+    uint64_t cr4 = read_cr4();
+    if (hasPge)
+        cr4 |= CR4_PGE;
+    // PCIDE can only go on while the current PCID is 0, which init_paging() leaves it at
+    if (pcid && !(cr3 & 0xFFF)) {
+        cr4 |= CR4_PCIDE;
+        hasPcid = true;
+    }
+    write_cr4(cr4);
+    hasInvpcid = hasInvpcid && hasPcid;
+    printk("[argaldOS:kernel:COR:TLB] global pages %s, PCID %s, INVPCID %s\n", hasPge ? "yes" : "no",
+           hasPcid ? "yes" : "no", hasInvpcid ? "yes" : "no");
+}
+
+bool tlb_has_pcid() {
+    return hasPcid;
+}
+
+// Drops every non-global entry of every PCID. Caller holds pcidLock.
+static void flush_all_contexts(void) {
+    if (hasInvpcid) {
+        invpcid(INVPCID_ALL, 0, 0);
+        return;
+    }
+    // toggling PGE empties the whole TLB, for all PCIDs
+    uint64_t cr4 = read_cr4();
+    write_cr4(cr4 ^ CR4_PGE);
+    write_cr4(cr4);
+}
+
+// Loads pml4_phys into CR3 under context's PCID, first giving it a new one if its generation has passed.
+void tlb_switch(struct tlbContext *context, uint64_t pml4_phys) {
+    uint64_t flags = spin_lock_irqsave(&pcidLock);
+    uint64_t cr3 = pml4_phys & 0x000FFFFFFFFFF000ULL;
+    if (hasPcid) {
+        if (context->generation == pcidGeneration || context->generation == TLB_GENERATION_PINNED) {
+            cr3 |= context->pcid | CR3_NOFLUSH;
+        } else {
+            if (nextPcid == PCID_COUNT) {
+                pcidGeneration++;
+                nextPcid = 1;
+                flush_all_contexts();
+            }
+            context->pcid = nextPcid++;
+            context->generation = pcidGeneration;
+            cr3 |= context->pcid;
+        }
+    }
+    currentContext[this_cpu()] = context;
+    asm volatile ("mov %0, %%cr3" :: "r"(cr3) : "memory");
+    spin_unlock_irqrestore(&pcidLock, flags);
+}
+
+// invlpg covers the current PCID and global entries, which is every kernel mapping
+void tlb_flush_page(uint64_t virt_addr) {
+    asm volatile ("invlpg (%0)" :: "r"(virt_addr) : "memory");
+}
+
+void tlb_flush_range(uint64_t virt_addr, uint64_t count) {
+    if (count <= INVLPG_MAX_PAGES) {
+        for (uint64_t i = 0; i < count; i++)
+            tlb_flush_page(virt_addr + i * PAGE_SIZE);
+        return;
+    }
+    // kernel half mappings are global and would survive a CR3 reload
+    if (virt_addr >= KERNEL_SPACE_START)
+        tlb_flush_all();
+    else
+        reload_cr3();
+}
+
+// Drops what the TLB holds for an address space, loaded or not.
+void tlb_flush_context(struct tlbContext *context) {
+    uint64_t flags = spin_lock_irqsave(&pcidLock);
+    bool current = currentContext[this_cpu()] == context;
+    if (!hasPcid || context->generation == TLB_GENERATION_PINNED) {
+        if (current || !hasPcid)
+            reload_cr3();
+        else if (hasInvpcid)
+            invpcid(INVPCID_CONTEXT, context->pcid, 0);
+        else
+            flush_all_contexts();
+    } else if (context->generation == pcidGeneration) {
+        if (hasInvpcid)
+            invpcid(INVPCID_CONTEXT, context->pcid, 0);
+        else if (current)
+            reload_cr3();
+        else
+            context->generation = 0; // it gets a fresh, clean PCID the next time it runs
+    }
+    spin_unlock_irqrestore(&pcidLock, flags);
+}
+
+// Everything, global kernel entries included.
+void tlb_flush_all() {
+    if (hasInvpcid) {
+        invpcid(INVPCID_ALL_GLOBAL, 0, 0);
+        return;
+    }
+    uint64_t cr4 = read_cr4();
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~(uint64_t)CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        reload_cr3();
+    }
+}
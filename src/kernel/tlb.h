@@ -0,0 +1,31 @@
+/* Header for ../tlb.c, PCID tagged address spaces and TLB invalidation.
+ * Every address space carries a tlbContext. tlb_switch() loads its tables under the PCID it owns, so the
+ * entries other address spaces left in the TLB are still there when they come back, and kernel mappings are
+ * global so no switch drops them.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef TLB_H
+#define TLB_H
+
+// A context with this generation keeps its PCID for good, the kernel's own tables run as PCID 0
+#define TLB_GENERATION_PINNED UINT64_MAX
+
+struct tlbContext {
+    uint64_t generation; // the PCID is only ours while this matches the allocator's, 0 before the first switch
+    uint16_t pcid;
+};
+
+#define TLB_CONTEXT_KERNEL { .generation = TLB_GENERATION_PINNED, .pcid = 0 }
+
+void tlb_init();
+bool tlb_has_pcid();
+void tlb_switch(struct tlbContext *context, uint64_t pml4_phys);
+void tlb_flush_page(uint64_t virt_addr);
+void tlb_flush_range(uint64_t virt_addr, uint64_t count);
+void tlb_flush_context(struct tlbContext *context);
+void tlb_flush_all();
+
+#endif
@@ -0,0 +1,203 @@
+/* Virtual memory areas and demand paging.
+ * A VMA reserves a page aligned range of an address space without backing it. The first access to each page
+ * faults, and vma_handle_fault() allocates a zeroed frame, lets the VMA's fill function copy in whatever the
+ * page should start out holding, and maps it. Pages that are never touched never cost a frame.
+ * Writes to pages a clone shares copy-on-write come through the same handler.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/kernel.h>
+#include <kernel/printk.h>
+#include <kernel/slab.h>
+#include <kernel/vmalloc.h>
+#include <kernel/simd.h>
+#include <kernel/pmm.h>
+#include <kernel/paging.h>
+#include <kernel/address_space.h>
+#include <kernel/vma.h>
+
+// page fault error code bits
+#define PF_PRESENT (1 << 0) // set for protection violations, clear when nothing was mapped
+#define PF_WRITE   (1 << 1)
+
+// frames are taken back this many at a time, so each batch is unmapped with one flush
+#define VMA_RELEASE_BATCH 64
+
+// An image with room for segment_count segments and data_size bytes, both for the caller to fill in, and one
+// reference, the caller's. Returns NULL if there's no memory for it.
+struct vmaImage* vma_image_create(uint32_t segment_count, uint64_t data_size) {
+    struct vmaImage *image = kmalloc(sizeof(*image));
+    if (!image)
+        return NULL;
+    image->refs = 1;
+    image->segment_count = segment_count;
+    image->data_size = data_size;
+    image->segments = segment_count ? kmalloc(segment_count * sizeof(struct vmaSegment)) : NULL;
+    image->data = data_size ? vmalloc(data_size) : NULL;
+    if ((segment_count && !image->segments) || (data_size && !image->data)) {
+        kfree(image->segments);
+        vfree(image->data);
+        kfree(image);
+        return NULL;
+    }
+    return image;
+}
+
+static void vma_image_get(struct vmaImage *image) {
+    if (image)
+        __atomic_fetch_add(&image->refs, 1, __ATOMIC_RELAXED);
+}
+
+void vma_image_put(struct vmaImage *image) {
+    if (!image || __atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    kfree(image->segments);
+    vfree(image->data);
+    kfree(image);
+}
+
+// A vmaFill that copies in the part of every segment of the VMA's image that falls into the page.
+void vma_image_fill(struct vma *vma, uint64_t virt_addr, uint8_t *page) {
+    struct vmaImage *image = vma->image;
+    for (uint32_t i = 0; image && i < image->segment_count; i++) {
+        struct vmaSegment *segment = &image->segments[i];
+        uint64_t start = segment->virt_addr > virt_addr ? segment->virt_addr : virt_addr;
+        uint64_t end = segment->virt_addr + segment->size;
+        if (end > virt_addr + PAGE_SIZE)
+            end = virt_addr + PAGE_SIZE;
+        if (start < end)
+            simd_memcpy(page + (start - virt_addr), image->data + segment->offset + (start - segment->virt_addr),
+                        end - start);
+    }
+}
+
+// Reserves [start, start + length), rounded out to whole pages, taking a reference to image. Fails if any of
+// it is already reserved or it reaches past the user half.
+bool vma_reserve(struct addressSpace *space, uint64_t start, uint64_t length, uint64_t flags, vmaFill fill,
+                 struct vmaImage *image) {
+    uint64_t first = start & ~0xFFFULL;
+    if (!length || start >= USER_SPACE_END || length > USER_SPACE_END - start)
+        return false;
+    uint64_t last = (start + length + 0xFFF) & ~0xFFFULL;
+
+    struct vma **link = &space->vmas;
+    while (*link && (*link)->end <= first)
+        link = &(*link)->next;
+    if (*link && (*link)->start < last)
+        return false;
+
+    struct vma *vma = kmalloc(sizeof(*vma));
+    if (!vma)
+        return false;
+    vma->start = first;
+    vma->end = last;
+    vma->flags = flags;
+    vma->fill = fill;
+    vma->image = image;
+    vma_image_get(image);
+    vma->next = *link;
+    *link = vma;
+    return true;
+}
+
+// Unmaps every page of the VMA that was touched and drops its reference to the frame.
+static void release_pages(struct addressSpace *space, struct vma *vma) {
+    uint64_t frames[VMA_RELEASE_BATCH];
+    for (uint64_t virt = vma->start; virt < vma->end; ) {
+        uint64_t batch = (vma->end - virt) / PAGE_SIZE;
+        if (batch > VMA_RELEASE_BATCH)
+            batch = VMA_RELEASE_BATCH;
+        uint64_t found = 0;
+        for (uint64_t i = 0; i < batch; i++) {
+            uint64_t phys = address_space_translate(space, virt + i * PAGE_SIZE);
+            if (phys)
+                frames[found++] = phys;
+        }
+        if (found) {
+            address_space_unmap(space, virt, batch);
+            for (uint64_t i = 0; i < found; i++)
+                page_release(frames[i], 0);
+        }
+        virt += batch * PAGE_SIZE;
+    }
+}
+
+// Drops the VMA starting at start, along with the pages it had backed.
+void vma_release(struct addressSpace *space, uint64_t start) {
+    struct vma **link = &space->vmas;
+    while (*link && (*link)->start != start)
+        link = &(*link)->next;
+    struct vma *vma = *link;
+    if (!vma) {
+        printk("[argaldOS:kernel:COR:VMM] vma_release: nothing reserved at %p\n", (void*)start);
+        return;
+    }
+    release_pages(space, vma);
+    *link = vma->next;
+    vma_image_put(vma->image);
+    kfree(vma);
+}
+
+struct vma* vma_find(struct addressSpace *space, uint64_t virt_addr) {
+    for (struct vma *vma = space->vmas; vma && vma->start <= virt_addr; vma = vma->next) {
+        if (virt_addr < vma->end)
+            return vma;
+    }
+    return NULL;
+}
+
+// Gives dst a copy of every VMA in src. The pages already backed are shared with the tables, not here.
+bool vma_clone_all(struct addressSpace *dst, struct addressSpace *src) {
+    struct vma **link = &dst->vmas;
+    for (struct vma *vma = src->vmas; vma; vma = vma->next) {
+        struct vma *copy = kmalloc(sizeof(*copy));
+        if (!copy)
+            return false;
+        *copy = *vma;
+        copy->next = NULL;
+        vma_image_get(copy->image);
+        *link = copy;
+        link = &copy->next;
+    }
+    return true;
+}
+
+// Frees the VMA list only, the frames go with the page tables in address_space_destroy().
+void vma_destroy_all(struct addressSpace *space) {
+    struct vma *vma = space->vmas;
+    while (vma) {
+        struct vma *next = vma->next;
+        vma_image_put(vma->image);
+        kfree(vma);
+        vma = next;
+    }
+    space->vmas = NULL;
+}
+
+// Called for every page fault. Returns true if the fault was a first touch of a reserved page and that page is
+// now mapped, or a write to a copy-on-write page that now has a frame of its own, false if it's a real fault.
+bool vma_handle_fault(uint64_t virt_addr, uint64_t error_code) {
+    struct addressSpace *space = address_space_current();
+    if (error_code & PF_PRESENT)
+        return (error_code & PF_WRITE) && virt_addr < USER_SPACE_END && address_space_write_fault(space, virt_addr);
+    struct vma *vma = vma_find(space, virt_addr);
+    if (!vma)
+        return false;
+    if ((error_code & PF_WRITE) && !(vma->flags & PAGE_RW))
+        return false;
+
+    uint64_t page_virt = virt_addr & ~0xFFFULL;
+    uint64_t frame = alloc_zeroed_page();
+    if (!frame) {
+        printk("[argaldOS:kernel:COR:VMM] out of memory backing %p\n", (void*)page_virt);
+        return false;
+    }
+    if (vma->fill)
+        vma->fill(vma, page_virt, (uint8_t*)(frame + kernel.hhdm));
+    if (!address_space_map(space, page_virt, &frame, 1, vma->flags)) {
+        free_pages(frame, 0);
+        return false;
+    }
+    return true;
+}
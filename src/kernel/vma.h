@@ -0,0 +1,54 @@
+/* Header for ../vma.c, reserved regions of an address space that get their pages on first touch.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef VMA_H
+#define VMA_H
+
+struct addressSpace;
+struct vma;
+
+// Fills a freshly zeroed page that is about to be mapped at virt_addr. page is its HHDM address.
+typedef void (*vmaFill)(struct vma *vma, uint64_t virt_addr, uint8_t *page);
+
+// size bytes at offset in an image's data belong at virt_addr
+struct vmaSegment {
+    uint64_t virt_addr;
+    uint64_t size;
+    uint64_t offset;
+};
+
+// What file backed VMAs are filled from: a copy of the bytes they need and where each piece goes, so the
+// file they came from can go away. Every VMA using it, those of clones included, holds a reference.
+struct vmaImage {
+    uint32_t refs;
+    uint32_t segment_count;
+    struct vmaSegment *segments;
+    uint8_t *data;
+    uint64_t data_size;
+};
+
+struct vma {
+    uint64_t start;         // page aligned
+    uint64_t end;           // page aligned, exclusive
+    uint64_t flags;         // PTE flags the pages are mapped with
+    vmaFill fill;           // NULL for anonymous memory, which stays all zeroes
+    struct vmaImage *image; // what fill reads from, or NULL
+    struct vma *next;       // sorted by start
+};
+
+struct vmaImage* vma_image_create(uint32_t segment_count, uint64_t data_size);
+void vma_image_put(struct vmaImage *image);
+void vma_image_fill(struct vma *vma, uint64_t virt_addr, uint8_t *page);
+
+bool vma_reserve(struct addressSpace *space, uint64_t start, uint64_t length, uint64_t flags, vmaFill fill,
+                 struct vmaImage *image);
+void vma_release(struct addressSpace *space, uint64_t start);
+struct vma* vma_find(struct addressSpace *space, uint64_t virt_addr);
+bool vma_clone_all(struct addressSpace *dst, struct addressSpace *src);
+void vma_destroy_all(struct addressSpace *space);
+bool vma_handle_fault(uint64_t virt_addr, uint64_t error_code);
+
+#endif
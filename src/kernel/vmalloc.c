@@ -0,0 +1,159 @@
+/* Virtually contiguous allocations backed by single frames.
+ * Each allocation takes a range of the vmalloc area and maps one separately allocated frame per page, so big
+ * buffers don't need the buddy allocator to find a high order block. The ranges in use are kept in a sorted
+ * array and new ones go in the first gap that fits, with an unmapped guard page after each so overruns fault
+ * instead of walking into the next allocation.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel/kernel.h>
+#include <kernel/printk.h>
+#include <kernel/pmm.h>
+#include <kernel/paging.h>
+#include <kernel/spinlock.h>
+#include <kernel/vmalloc.h>
+
+#define VMALLOC_MAX_AREAS 256
+
+struct vmArea {
+    uint64_t start;
+    uint64_t pages; // mapped pages, the guard page after them isn't counted
+};
+
+// sorted by start
+static struct vmArea areas[VMALLOC_MAX_AREAS];
+static int areaCount = 0;
+static spinlock_t areaLock = SPINLOCK_INIT;
+
+// Finds a gap for pages + 1 guard page and records it. Returns the start address, or 0.
+static uint64_t reserve_area(uint64_t pages) {
+    uint64_t span = (pages + 1) * PAGE_SIZE;
+    uint64_t flags = spin_lock_irqsave(&areaLock);
+    uint64_t start = 0;
+    if (areaCount < VMALLOC_MAX_AREAS) {
+        uint64_t candidate = VMALLOC_START;
+        int slot = 0;
+        for (; slot < areaCount; slot++) {
+            if (areas[slot].start - candidate >= span)
+                break;
+            candidate = areas[slot].start + (areas[slot].pages + 1) * PAGE_SIZE;
+        }
+        if (VMALLOC_END - candidate >= span) {
+            for (int i = areaCount; i > slot; i--)
+                areas[i] = areas[i - 1];
+            areas[slot].start = candidate;
+            areas[slot].pages = pages;
+            areaCount++;
+            start = candidate;
+        }
+    }
+    spin_unlock_irqrestore(&areaLock, flags);
+    return start;
+}
+
+// Index of the area starting at start, or -1. Caller holds areaLock.
+static int find_area(uint64_t start) {
+    int low = 0;
+    int high = areaCount - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (areas[mid].start < start)
+            low = mid + 1;
+        else if (areas[mid].start > start)
+            high = mid - 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+static uint64_t area_pages(uint64_t start) {
+    uint64_t flags = spin_lock_irqsave(&areaLock);
+    int index = find_area(start);
+    uint64_t pages = index < 0 ? 0 : areas[index].pages;
+    spin_unlock_irqrestore(&areaLock, flags);
+    return pages;
+}
+
+// Only once its pages are unmapped, or the range could be handed out again while still mapped.
+static void release_area(uint64_t start) {
+    uint64_t flags = spin_lock_irqsave(&areaLock);
+    int index = find_area(start);
+    if (index >= 0) {
+        for (int i = index; i < areaCount - 1; i++)
+            areas[i] = areas[i + 1];
+        areaCount--;
+    }
+    spin_unlock_irqrestore(&areaLock, flags);
+}
+
+// Frames are gathered this many at a time so each batch costs one page table walk per PT and one TLB flush.
+#define VMALLOC_BATCH 64
+
+static void unmap_and_free(uint64_t start, uint64_t pages) {
+    uint64_t frames[VMALLOC_BATCH];
+    for (uint64_t done = 0; done < pages; ) {
+        uint64_t batch = pages - done < VMALLOC_BATCH ? pages - done : VMALLOC_BATCH;
+        for (uint64_t i = 0; i < batch; i++)
+            frames[i] = virt_to_phys(start + (done + i) * PAGE_SIZE);
+        // no frame goes back before the TLB has forgotten it
+        unmap_pages(start + done * PAGE_SIZE, batch);
+        for (uint64_t i = 0; i < batch; i++) {
+            if (frames[i])
+                free_pages(frames[i], 0);
+        }
+        done += batch;
+    }
+}
+
+// Returns a page aligned, virtually contiguous kernel buffer of at least size bytes, or NULL.
+void* vmalloc(size_t size) {
+    if (size == 0)
+        return NULL;
+    uint64_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t start = reserve_area(pages);
+    if (!start) {
+        printk("[VMALLOC] vmalloc: no room for %d pages\n", pages);
+        return NULL;
+    }
+    uint64_t frames[VMALLOC_BATCH];
+    for (uint64_t done = 0; done < pages; ) {
+        uint64_t batch = pages - done < VMALLOC_BATCH ? pages - done : VMALLOC_BATCH;
+        for (uint64_t i = 0; i < batch; i++) {
+            frames[i] = alloc_pages(0);
+            if (!frames[i]) {
+                while (i--)
+                    free_pages(frames[i], 0);
+                unmap_and_free(start, done);
+                release_area(start);
+                return NULL;
+            }
+        }
+        if (!map_page_list(start + done * PAGE_SIZE, frames, batch, PAGE_PRESENT | PAGE_RW)) {
+            printk("[VMALLOC] vmalloc: out of memory for page tables\n");
+            // part of the batch may be mapped already
+            unmap_pages(start + done * PAGE_SIZE, batch);
+            for (uint64_t i = 0; i < batch; i++)
+                free_pages(frames[i], 0);
+            unmap_and_free(start, done);
+            release_area(start);
+            return NULL;
+        }
+        done += batch;
+    }
+    return (void*)start;
+}
+
+void vfree(void* ptr) {
+    if (!ptr)
+        return;
+    uint64_t start = (uint64_t)ptr;
+    uint64_t pages = area_pages(start);
+    if (!pages) {
+        printk("[VMALLOC] vfree: %p was not returned by vmalloc\n", ptr);
+        return;
+    }
+    unmap_and_free(start, pages);
+    release_area(start);
+}
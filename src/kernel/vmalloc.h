@@ -0,0 +1,17 @@
+/* Header for ../vmalloc.c, virtually contiguous kernel allocations.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+// 1 TiB of kernel half address space, well clear of the HHDM and the kernel image
+#define VMALLOC_START 0xFFFFC00000000000ULL
+#define VMALLOC_END   0xFFFFC10000000000ULL
+
+void* vmalloc(size_t size);
+void vfree(void* ptr);
+
+#endif
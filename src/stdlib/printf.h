@@ -108,6 +108,11 @@ int vprintf_(const char* format, va_list va);
  */
 int fctprintf(void (*out)(char character, void* arg), void* arg, const char* format, ...);
 
+/**
+ * Same as fctprintf(), taking a va_list
+ */
+int vfctprintf(void (*out)(char character, void* arg), void* arg, const char* format, va_list va);
+
 
 #ifdef __cplusplus
 }
@@ -1,6 +1,19 @@
 #include <stdbool.h>
 #include <stdlib/string.h>
 
+// Word at a time helpers. A word has a zero byte iff (w - 0x01..01) & ~w & 0x80..80 is non zero.
+// Only aligned words are ever loaded past the point known to be inside the string, and an aligned word
+// never straddles a page, so reading a few bytes beyond the terminator can't fault.
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+typedef uint64_t __attribute__((may_alias)) string_word;
+// those reads past the terminator are deliberate, keep AddressSanitizer quiet about them in host builds
+#define WORD_AT_A_TIME __attribute__((no_sanitize("address")))
+
+static inline bool has_zero_byte(uint64_t word) {
+    return ((word - ONES) & ~word & HIGHS) != 0;
+}
+
 void addCharToString(char *str, char c) {
     // Iterate to find the end of the string
     int i = 0;
@@ -134,11 +147,17 @@ void reverse(char s[]) {
     }
 }
 
-/* K&R */
-int strlen(const char s[]) {
-    int i = 0;
-    while (s[i] != '\0') ++i;
-    return i;
+WORD_AT_A_TIME int strlen(const char s[]) {
+    const char *p = s;
+    while ((uintptr_t)p & 7) {
+        if (*p == '\0') return p - s;
+        p++;
+    }
+    const string_word *w = (const string_word *)p;
+    while (!has_zero_byte(*w)) w++;
+    p = (const char *)w;
+    while (*p != '\0') p++;
+    return p - s;
 }
 
 void append(char s[], char n) {
@@ -152,24 +171,42 @@ void backspace(char s[]) {
     s[len-1] = '\0';
 }
 
-/* K&R 
- * Returns <0 if s1<s2, 0 if s1==s2, >0 if s1>s2 */
+/* Returns <0 if s1<s2, 0 if s1==s2, >0 if s1>s2 */
 int k_n_r_strcmp(char s1[], char s2[]) {
-    int i;
-    for (i = 0; s1[i] == s2[i]; i++) {
-        if (s1[i] == '\0') return 0;
+    return strncmp(s1, s2, SIZE_MAX);
+}
+
+/* Compares at most n characters, ordering them as unsigned char like the C library does.
+ * When both strings sit at the same offset within a word, whole words are compared until one differs
+ * or holds the terminator; otherwise it's byte by byte. */
+WORD_AT_A_TIME int strncmp(const char* s1, const char* s2, size_t n) {
+    const unsigned char *p1 = (const unsigned char *)s1;
+    const unsigned char *p2 = (const unsigned char *)s2;
+    if ((((uintptr_t)p1 ^ (uintptr_t)p2) & 7) == 0) {
+        while (n && ((uintptr_t)p1 & 7)) {
+            if (*p1 != *p2 || *p1 == '\0') return *p1 - *p2;
+            p1++; p2++; n--;
+        }
+        while (n >= 8) {
+            uint64_t w1 = *(const string_word *)p1;
+            uint64_t w2 = *(const string_word *)p2;
+            if (w1 != w2 || has_zero_byte(w1)) break;
+            p1 += 8; p2 += 8; n -= 8;
+        }
+    }
+    for (; n; p1++, p2++, n--) {
+        if (*p1 != *p2 || *p1 == '\0') return *p1 - *p2;
     }
-    return s1[i] - s2[i];
+    return 0;
 }
 
+int strcmp_order(const char* str1, const char* str2) {
+    return strncmp(str1, str2, SIZE_MAX);
+}
+
+// Equality only, see strcmp_order() for sorting.
 bool strcmp(const char* str1, const char* str2) {
-    int str1len = strlen(str1);
-    int str2len = strlen(str2);
-    if (str1len != str2len) return false;
-    for (int c = 0; c < str1len && c < str2len; c++) {
-        if (str1[c] != str2[c]) return false;
-    }
-    return true;
+    return strncmp(str1, str2, SIZE_MAX) == 0;
 }
 
 
@@ -1,6 +1,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #ifndef STRINGS_H
 #define STRINGS_H
@@ -22,7 +23,11 @@ int strlen(const char s[]);
 void backspace(char s[]);
 void append(char s[], char n);
 int k_n_r_strcmp(char s1[], char s2[]);
+// true when the strings are equal, this is not the C library strcmp
 bool strcmp(const char* str1, const char* str2);
+// <0, 0 or >0 like the C library strcmp/strncmp
+int strcmp_order(const char* str1, const char* str2);
+int strncmp(const char* s1, const char* s2, size_t n);
 
 void strcpy(char* dest, const char* src);
 void strncpy_safe(char* dest, const char* src, size_t n);